@@ -1,10 +1,112 @@
 #ifndef ADC_H
 #define ADC_H
 
+#include <stdint.h>
+
+#include "sonar.h"
+
 #define LIGHT_CHAN 2 //ADC channel for light sensor
 #define SONAR_CHAN 3 //ADC channel for sonar sensor
 
+/*
+	Scan engine: ADC_vect converts the channels of ADC_SCAN round robin, and each sample is
+	started by the Timer1 compare B match of the clock (every CLOCK_TICK_MS), so clock_init()
+	must have been called. With two channels each is sampled at a steady 100 Hz, and the CPU
+	only spends ~60 cycles per conversion instead of spinning ~110us in adc_sample()
+	A scan is written to the back half of a double buffer and published all at once by
+	swapping the halves, so the values read between two scans always belong together
+*/
+#if SONAR_PW
+#define ADC_SCAN {LIGHT_CHAN, LIGHT_CHAN}	// The sonar slot takes the pulse width, its one conversion only paces it
+#else
+#define ADC_SCAN {LIGHT_CHAN, SONAR_CHAN}	// Channels in scan order
+#endif
+#define ADC_LIGHT 0							// Index of each channel in ADC_SCAN
+#define ADC_SONAR 1
+#define ADC_SAMPLE_MS 10					// Time between samples of a channel, CLOCK_TICK_MS per channel
+
+/*
+	Filtering: every sample goes through a sliding median of ADC_MEDIAN samples (1, 3 or 5),
+	then an exponential moving average with weight 1/2^ADC_EMA_SHIFT (0 turns it off), both
+	in the ADC interrupt with compares and shifts only. The median drops spikes of up to
+	(ADC_MEDIAN-1)/2 samples in a row, the average shrinks what gets through
+
+	Latency of a step, in samples and in ms at ADC_SAMPLE_MS per sample:
+	  ADC_MEDIAN  ADC_EMA_SHIFT  to 50% of the step  to 90% of the step
+	  1           0              1    10ms           1    10ms
+	  3           1              2    20ms           5    50ms
+	  5           1              3    30ms           6    60ms
+	  5           2              5    50ms           10   100ms   (default)
+	  5           3              8    80ms           20   200ms
+	  5           4              13   130ms          38   380ms
+	The main loop sees a reading up to 10ms later. A MaxBotix sonar only updates every 49ms,
+	so one bad echo lasts ~5 samples: the median doesn't remove it, the average only cuts it
+	to ~75% of its size (ADC_EMA_SHIFT 2) or ~50% (ADC_EMA_SHIFT 3)
+*/
+/*
+	Oversampling: each trigger starts a burst of 4^ADC_OVERSAMPLE_BITS conversions of the slot's
+	channel, back to back from ADC_vect (not for the SONAR_PW sonar slot, the trigger's conversion
+	only paces it), and the slot keeps their sum >> ADC_OVERSAMPLE_BITS,
+	10+ADC_OVERSAMPLE_BITS bits. A burst of 16 takes 16*113us = 1.8ms, inside the 5ms between
+	triggers, for ~50 cycles per conversion. Noise of at least ~0.5 LSB dithers the extra bits
+	adc_read() returns all the bits, light_reading() 10 bits and sonar_reading() inches
+
+	Sleep: the CPU is the main source of digital noise on the ADC, so it shouldn't be running
+	during conversions. adc_wait() idles (SLEEP_MODE_IDLE) until the next scan, which stops
+	only the CPU clock: the timers, the UART and the LCD queue carry on. ADC noise reduction
+	sleep (SLEEP_MODE_ADC) is init-only: adc_sample() uses it for the first scan in adc_init(),
+	with ADC_SLEEP set, before the clock and the GPS start. It also stops the I/O clock, so at
+	run time Timer1 and the clock would lose ~113us and the UART could lose a GPS character
+	per conversion
+
+	Estimates, not measured on the board: rms error of a reading in 10 bit LSB, for a steady input
+	with gaussian noise of 1 LSB while the CPU runs and 0.5 LSB while it sleeps (simulated):
+	  ADC_OVERSAMPLE_BITS  conversions  CPU running  CPU asleep
+	  0                    1            1.04         0.58
+	  1                    4            0.55         0.34
+	  2                    16           0.29         0.19         (default)
+	Estimated current of the ATmega328P alone at 7.3728 MHz, 5V, from the datasheet's typical figures:
+	~5mA active, ~1.2mA idle, ~1mA in ADC noise reduction, plus ~0.3mA for the ADC
+	  adc_sample() spinning: ~5.3mA for 113us, 0.6uC per conversion
+	  adc_sample() asleep:   ~1.3mA for 113us, 0.15uC per conversion
+	  Main loop spinning in _delay_ms(): ~5.3mA
+	  Main loop in adc_wait(): ~1.8mA, with the CPU awake ~7% of the time (the loop, the ADC
+	  bursts, the clock, the GPS characters and one LCD redraw per second)
+	The GPS, the sonar and the backlight draw far more than the microcontroller
+*/
+#ifndef ADC_OVERSAMPLE_BITS
+#define ADC_OVERSAMPLE_BITS 2
+#endif
+#define ADC_OVERSAMPLE (1 << (2*ADC_OVERSAMPLE_BITS))	// Conversions per sample
+#ifndef ADC_SLEEP
+#define ADC_SLEEP 1
+#endif
+#if ADC_OVERSAMPLE_BITS > 2
+#error "ADC_OVERSAMPLE_BITS must be 2 or less, a burst has to fit between two triggers"
+#endif
+
+#ifndef ADC_MEDIAN
+#define ADC_MEDIAN 5
+#endif
+#ifndef ADC_EMA_SHIFT
+#define ADC_EMA_SHIFT 2
+#endif
+#if ADC_MEDIAN != 1 && ADC_MEDIAN != 3 && ADC_MEDIAN != 5
+#error "ADC_MEDIAN must be 1, 3 or 5"
+#endif
+#if ADC_EMA_SHIFT + ADC_OVERSAMPLE_BITS > 6
+#error "ADC_EMA_SHIFT + ADC_OVERSAMPLE_BITS must be 6 or less, the average is kept in 16 bits"
+#endif
+#if SONAR_PW
+#if (SONAR_PW_SCALE(SONAR_PW_MAX) << ADC_EMA_SHIFT) > 0xFFFF
+#error "ADC_EMA_SHIFT is too large for SONAR_PW, the longest pulse must fit the 16 bit average"
+#endif
+#endif
+
 void adc_init();
+uint16_t adc_read(uint8_t index);
+uint8_t adc_sequence(void);
+void adc_wait(void);
 uint16_t light_reading();
 uint16_t sonar_reading();
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,19 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+/*
+	Millisecond clock since reset
+	Timer1 runs free at FREQ/8, the same set up LCD_ASYNC uses for compare A, and compare B
+	fires every 4608 ticks, exactly CLOCK_TICK_MS at 7.3728 MHz. That is 200 interrupts of
+	~40 cycles each per second, about 0.1% of the CPU. The compare B match also starts the
+	ADC scan conversions, see adc.h
+*/
+#define CLOCK_TICK_MS 5
+#define CLOCK_TICKS ((uint16_t)(7372800UL/8*CLOCK_TICK_MS/1000))
+
+void clock_init(void);
+uint32_t clock_ms(void);
+
+#endif
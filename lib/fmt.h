@@ -0,0 +1,24 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <stdint.h>
+
+/*
+	Fixed-point number formatting without printf
+	Every function writes exactly 'width' (or its stated number of) characters and no '\0', so
+	it can write straight into a layout slot of the LCD frame. Values are right-aligned and
+	digits that don't fit are dropped from the left
+
+	Cycles at 7.3728 MHz (avr-gcc -Os, estimated from the libgcc division routines):
+	  fmt_2digits         ~20     (8 bit division by a constant)
+	  fmt_hms             ~500    ("HH:MM:SS" from uint16_t seconds)
+	  fmt_uint/fmt_fixed  ~230 per digit below 65536, ~650 per digit above
+	snprintf("%02d:%02d:%02d") took ~3000 cycles and pulled in ~1.9 KB of vfprintf
+*/
+
+void fmt_2digits(char* str, uint8_t value);
+void fmt_hms(char* str, uint16_t seconds);
+void fmt_uint(char* str, uint8_t width, uint32_t value, char pad);
+void fmt_fixed(char* str, uint8_t width, int32_t value, uint8_t decimals);
+
+#endif
@@ -3,12 +3,145 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <string.h>
 
+#include "gps_config.h"
+#include "lcd.h"
+
 #define FREQ 7372800
-#define BAUD 9600
+#define BAUD 9600 // Baud rate of the GPS module at power up
 #define UBRR FREQ/16/BAUD-1
+
+/*
+	High-rate mode: gps_init() switches the module to GPS_BAUD with PMTK251 and asks for
+	GPS_RATE_HZ fixes per second with PMTK220. Override either with -D
+
+	Cycle budget at 7.3728 MHz, the default RMC+GGA is about 150 characters per fix:
+	  GPS_BAUD  cycles/char  chars/s needed at 1/5/10 Hz  USART_RX_vect load at 10 Hz
+	  9600      7680         150/750/1500 (10 Hz too fast)  -
+	  38400     1920         150/750/1500                   ~150k cycles/s, 2% CPU
+	  57600     1280                                        ~150k cycles/s, 2% CPU
+	  115200    640                                         ~150k cycles/s, 2% CPU
+	USART_RX_vect takes about 100 cycles per character including prologue and epilogue, well inside
+	the 640 cycles between characters at 115200. The USART holds one character in UDR0 while the next
+	is shifted in, so other interrupts may delay it by up to ~1200 cycles at 115200 without overruns.
+	The main loop parses one sentence in about 3k cycles and redraws the LCD in about 10 ms, so at
+	10 Hz (20 sentences/s) it is busy less than a quarter of the time. GPS_RING_SLOTS covers the
+	RMC+GGA burst that arrives back to back at the start of each fix.
+*/
+#ifndef GPS_BAUD
+#define GPS_BAUD 9600
+#endif
+#ifndef GPS_RATE_HZ
+#define GPS_RATE_HZ 1
+#endif
+
+/*
+	Binary mode: with GPS_BINARY set to 1 gps_init() also sends PGCMD,16 to switch MediaTek
+	modules running the DIYDrones firmware to its binary output. Each fix is then one 37 byte
+	packet (0xD1 0xDD, length, 32 byte payload, 2 byte Fletcher checksum) that is copied into
+	gps_fix without any text parsing. Modules that don't know PGCMD,16 keep sending NMEA, which
+	the streaming parser still accepts, so GPS_BINARY needs GPS_STREAM
+
+	Per fix, default RMC+GGA against one binary packet, estimated at 7.3728 MHz:
+	                   bytes  line time at 9600  USART_RX_vect  gps_update()  cycles total
+	  NMEA (stream)    ~150   156 ms             ~9k cycles     ~14k cycles   ~23k (3.1 ms)
+	  Binary           37     39 ms              ~2.2k cycles   ~3.5k cycles  ~5.7k (0.8 ms)
+	Most of the binary gps_update() time is the divisions that split the packed date and time
+*/
+#ifndef GPS_BINARY
+#define GPS_BINARY 0
+#endif
+#define GPS_BINARY_LEN 37 // Bytes per binary packet
+
+#if GPS_BINARY
+#define GPS_LINE_BYTES GPS_BINARY_LEN
+#else
+#define GPS_LINE_BYTES GPS_BYTES_PER_FIX
+#endif
+
+#if GPS_BAUD != 9600 && GPS_BAUD != 38400 && GPS_BAUD != 57600 && GPS_BAUD != 115200
+#error "GPS_BAUD must be 9600, 38400, 57600 or 115200"
+#endif
+#if GPS_RATE_HZ != 1 && GPS_RATE_HZ != 5 && GPS_RATE_HZ != 10
+#error "GPS_RATE_HZ must be 1, 5 or 10"
+#endif
+#if GPS_RATE_HZ*GPS_LINE_BYTES > GPS_BAUD/10*9/10
+#error "GPS_BAUD is too slow for GPS_RATE_HZ, the selected sentences would use more than 90% of the line"
+#endif
+
+// UBRR values and resulting baud rates in normal (16x) and double speed (8x) mode
+#define GPS_UBRR_16 ((FREQ+8UL*GPS_BAUD)/(16UL*GPS_BAUD)-1)
+#define GPS_UBRR_8  ((FREQ+4UL*GPS_BAUD)/(8UL*GPS_BAUD)-1)
+#define GPS_ERR_16  ((FREQ/(16UL*(GPS_UBRR_16+1)) > GPS_BAUD)?(FREQ/(16UL*(GPS_UBRR_16+1))-GPS_BAUD):(GPS_BAUD-FREQ/(16UL*(GPS_UBRR_16+1))))
+#define GPS_ERR_8   ((FREQ/(8UL*(GPS_UBRR_8+1)) > GPS_BAUD)?(FREQ/(8UL*(GPS_UBRR_8+1))-GPS_BAUD):(GPS_BAUD-FREQ/(8UL*(GPS_UBRR_8+1))))
+
+// Double speed is only used when it gets closer to GPS_BAUD
+// 7.3728 MHz divides evenly into every supported baud rate, so normal mode is exact there
+#if GPS_ERR_8 < GPS_ERR_16
+#define GPS_U2X 1
+#define GPS_UBRR GPS_UBRR_8
+#else
+#define GPS_U2X 0
+#define GPS_UBRR GPS_UBRR_16
+#endif
+
+/*
+	Streaming mode: with GPS_STREAM set to 1 the RX interrupt only queues characters in a
+	GPS_FIFO_SIZE byte FIFO and gps_update() parses them field by field, skipping sentences
+	that are not needed without storing them. This replaces the GPS_RING_SLOTS sentence ring
+	(over 300 bytes) with about 60 bytes of field and scratch fix state plus the FIFO, but the FIFO
+	must hold every character that arrives between calls to gps_update(). The main loop calls it
+	once per pass, and a pass sleeps in adc_wait() until the next sensor scan (up to 10ms) and
+	may redraw the LCD (up to ~9ms without LCD_ASYNC), so GPS_POLL_MS is the longest gap.
+	The FIFO is sized for a full line at GPS_BAUD over that gap:
+	  GPS_BAUD  chars in GPS_POLL_MS  GPS_FIFO_SIZE
+	  9600      19                    32
+	  38400     76                    128
+	  57600     115                   128
+	  115200    230                   256
+	gps_check(), gps_acquire(), gps_release() and gps_parse() are not available in this mode
+*/
+#ifndef GPS_STREAM
+#define GPS_STREAM GPS_BINARY
+#endif
+#if GPS_BINARY && !GPS_STREAM
+#error "GPS_BINARY needs GPS_STREAM"
+#endif
+#define GPS_POLL_MS 20 // Longest time between gps_update() calls in the main loop
+#define GPS_FIFO_NEEDED (GPS_BAUD/10*GPS_POLL_MS/1000)
+#ifndef GPS_FIFO_SIZE // Must be a power of 2, 256 at most
+#if GPS_FIFO_NEEDED <= 32
+#define GPS_FIFO_SIZE 32
+#elif GPS_FIFO_NEEDED <= 64
+#define GPS_FIFO_SIZE 64
+#elif GPS_FIFO_NEEDED <= 128
+#define GPS_FIFO_SIZE 128
+#else
+#define GPS_FIFO_SIZE 256
+#endif
+#endif
+#if GPS_STREAM && (GPS_FIFO_SIZE < GPS_FIFO_NEEDED || GPS_FIFO_SIZE > 256)
+#error "GPS_FIFO_SIZE can't hold the characters GPS_BAUD delivers in GPS_POLL_MS, or is over 256"
+#endif
+#define GPS_FIELD_LEN 12 // Longest field the parser needs to store (ddmm.mmmmmm)
+
+// Sentences received before a missing fix is reported, about 30 seconds of the selected sentences
+#if GPS_BINARY
+#define GPS_TIMEOUT_MSGS (30*GPS_RATE_HZ)
+#else
+#define GPS_TIMEOUT_MSGS (30*GPS_RATE_HZ*GPS_SENTENCES_PER_FIX)
+#endif
 #define MAX_SENTENCE_LEN 80
+#define GPS_MAX_FIELDS 20 // GSV is the longest sentence with 20 fields
+
+// Number of sentence slots shared between the RX interrupt and the main loop
+// One slot is always being filled, so up to GPS_RING_SLOTS-1 sentences can wait to be read
+// 3 slots hold a full RMC+GGA epoch while the main loop is busy writing to the LCD
+#ifndef GPS_RING_SLOTS
+#define GPS_RING_SLOTS 3
+#endif
 
 #define VALID_DATE (1 << 0)
 #define VALID_TIME (1 << 1)
@@ -16,17 +149,79 @@
 #define VALID_ALT  (1 << 3)
 #define VALID_SPD  (1 << 4)
 #define VALID_DIR  (1 << 5)
+#define VALID_SATS (1 << 6)
+#define VALID_HDOP (1 << 7)
+#define VALID_DOP  (1 << 8)
+#define VALID_MODE (1 << 9)
+#define VALID_VIEW (1 << 10)
 
 #define VALID_LINE_0 (VALID_DATE | VALID_TIME)
 #define VALID_LINE_1 (VALID_LOC)
 #define VALID_LINE_2 (VALID_LOC)
 #define VALID_LINE_3 (VALID_ALT | VALID_SPD | VALID_DIR)
 
+// gps_layout() line of the big speed readout on rows 1 and 2
+#define GPS_LINE_BIG_SPEED 6
+
+// NMEA sentence types
+#define SENTENCE_RMC (1 << 0)
+#define SENTENCE_GGA (1 << 1)
+#define SENTENCE_VTG (1 << 2)
+#define SENTENCE_GSA (1 << 3)
+#define SENTENCE_GSV (1 << 4)
+#define SENTENCE_ZDA (1 << 5)
+
+// Sentences with a UTC time that the module sends for every fix, gps_update() reports a fix once all of them arrive
+#define GPS_EPOCH_SENTENCES (((GPS_USE_RMC == 1)?SENTENCE_RMC:0) | ((GPS_USE_GGA == 1)?SENTENCE_GGA:0) | \
+							 ((GPS_USE_ZDA == 1)?SENTENCE_ZDA:0))
+
+// Sentence received by the RX interrupt, already split into fields
+// Field i is text[field[i]] up to the ',' or '*' at text[field[i+1]-1]
+typedef struct {
+	char text[MAX_SENTENCE_LEN];		// Sentence without the leading '$'
+	uint8_t len;						// Number of characters in text
+	uint8_t count;						// Number of fields, 0 if the checksum is invalid
+	uint8_t field[GPS_MAX_FIELDS+1];	// Start offset of each field, plus one past the last
+} gps_sentence_t;
+
+// Latest fix in binary form, filled by gps_parse() from whichever sentences carry each field
+typedef struct {
+	int32_t lat;			// Latitude in 1e-7 degrees, positive north
+	int32_t lon;			// Longitude in 1e-7 degrees, positive east
+	int32_t alt;			// Altitude above mean sea level in 0.1 m
+	uint16_t speed;			// Speed over ground in 0.01 knots
+	uint16_t course;		// Course over ground in 0.01 degrees
+	uint16_t hdop;			// Horizontal dilution of precision in 0.01
+	uint16_t pdop;			// Position dilution of precision in 0.01
+	uint16_t vdop;			// Vertical dilution of precision in 0.01
+	uint8_t hour;			// UTC time
+	uint8_t minute;
+	uint8_t second;
+	uint8_t centisecond;
+	uint8_t day;			// UTC date
+	uint8_t month;
+	uint8_t year;			// Years since 2000
+	uint8_t quality;		// GGA fix quality (0 - No fix, 1 - GPS fix, 2 - DGPS fix)
+	uint8_t sats;			// Satellites used in the fix
+	uint8_t sats_view;		// Satellites in view
+	uint8_t mode;			// GSA fix mode (1 - No fix, 2 - 2D fix, 3 - 3D fix)
+	uint16_t valid;			// VALID_* bits of the fields above
+} gps_fix_t;
+
 void gps_init(void);
+uint8_t gps_init_step(void);
+uint8_t gps_update(void);
+int8_t gps_status(void);
+#if !GPS_STREAM
 uint8_t gps_check();
-uint8_t gps_readline(char* str);
-int8_t gps_parse(char* str, uint8_t length);
+const gps_sentence_t* gps_acquire(void);
+void gps_release(void);
+int8_t gps_parse(const gps_sentence_t* s);
+#endif
+const lcd_layout_t* gps_layout(uint8_t line);
+uint16_t gps_dropped(void);
+uint8_t gps_high_water(void);
 
-extern char display_screen[6][21];
+extern gps_fix_t gps_fix;
 extern volatile uint16_t elapsedTime;
 #endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef GPS_CONFIG_H
+#define GPS_CONFIG_H
+
+/*
+	NMEA sentences to parse and have the GPS module send
+	0 - Sentence is turned off and its parser is not compiled in
+	1-5 - Module sends the sentence once every 1-5 fixes
+	gps_init() builds the PMTK314 output selection from these values
+*/
+#ifndef GPS_USE_RMC
+#define GPS_USE_RMC 1 // Time, date, position, speed and course
+#endif
+#ifndef GPS_USE_VTG
+#define GPS_USE_VTG 0 // Speed and course only
+#endif
+#ifndef GPS_USE_GGA
+#define GPS_USE_GGA 1 // Time, position, altitude, fix quality, satellites used and HDOP
+#endif
+#ifndef GPS_USE_GSA
+#define GPS_USE_GSA 0 // 2D/3D fix mode and PDOP/HDOP/VDOP
+#endif
+#ifndef GPS_USE_GSV
+#define GPS_USE_GSV 0 // Satellites in view
+#endif
+#ifndef GPS_USE_ZDA
+#define GPS_USE_ZDA 0 // Time and date with a 4 digit year
+#endif
+
+// Sentences and characters sent per fix when every selected sentence is sent, GSV takes 3 sentences
+#define GPS_SENTENCES_PER_FIX ((GPS_USE_RMC != 0) + (GPS_USE_VTG != 0) + (GPS_USE_GGA != 0) + \
+							   (GPS_USE_GSA != 0) + 3*(GPS_USE_GSV != 0) + (GPS_USE_ZDA != 0))
+#define GPS_BYTES_PER_FIX (70*(GPS_USE_RMC != 0) + 40*(GPS_USE_VTG != 0) + 75*(GPS_USE_GGA != 0) + \
+						   66*(GPS_USE_GSA != 0) + 210*(GPS_USE_GSV != 0) + 38*(GPS_USE_ZDA != 0))
+
+#endif
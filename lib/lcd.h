@@ -2,6 +2,9 @@
 #define LCD_H
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #define LCD_DATA_BITS ((1 << PB5)|(1 << PB4)|(1 << PB3)|(1 << PB2))
@@ -9,16 +12,105 @@
 #define LCD_RS_BIT (1 << PB0)
 #define LCD_EN_BIT (1 << PD4)
 
+#define LCD_RW_BIT (1 << PC0) // Only wired with LCD_BUSY_FLAG
+
+/*
+    Busy flag mode: with LCD_BUSY_FLAG set to 1 and R/W wired to LCD_RW_BIT, each byte waits for
+    the HD44780 to clear its busy flag (DB7) instead of a fixed worst case delay
+    (50us after every nibble, 2ms after clear and home). Typical timing at the nominal 270kHz:
+                        fixed delays  busy flag
+      Character         102us         ~41us (37us execution + write and one flag read)
+      lcd_clear()       2.1ms         ~1.55ms
+      80 character frame  8.2ms       ~3.3ms
+    Set LCD_BUSY_FLAG to 0 when R/W is tied to ground
+*/
+#ifndef LCD_BUSY_FLAG
+#define LCD_BUSY_FLAG 0
+#endif
+#define LCD_BUSY_POLLS 1000 // Give up waiting after ~5ms, so a missing LCD doesn't hang the firmware
+#define LCD_POLL_US 10      // Interval between busy flag reads in LCD_ASYNC mode
+
+#define LCD_ROWS 4
+#define LCD_COLS 20
+#define LCD_CELLS (LCD_ROWS*LCD_COLS)
+
+/*
+    Asynchronous mode: with LCD_ASYNC set to 1, commands and characters are queued and the
+    TIMER1_COMPA interrupt sends one byte every LCD_BYTE_US, so lcd_* calls return at once
+    instead of spinning ~100us per character. lcd_clear() and lcd_home() queue their 2ms wait.
+    Timer1 runs free at FREQ/8 (1.085us per tick) and only compare A is used, so it is left
+    for other users of Timer1. The power up sequence is not queued: lcd_init() spins through it,
+    lcd_init_step() leaves the waits to the caller. lcd_* calls spin only when the queue is full,
+    which needs interrupts enabled
+*/
+#ifndef LCD_ASYNC
+#define LCD_ASYNC 0
+#endif
+#ifndef LCD_QUEUE_SIZE
+#define LCD_QUEUE_SIZE 64 // Bytes and waits, must be a power of 2
+#endif
+#define LCD_BYTE_US 50 // Wait after each byte, at least the 37us the HD44780 needs
+#define LCD_TIMER_HZ (7372800/8)
+#define LCD_US_TICKS(us) ((uint16_t)((uint32_t)(us)*LCD_TIMER_HZ/1000000+1))
+
 #define LCD_R_BIT (1 << PD3)
 #define LCD_G_BIT (1 << PD5)
 #define LCD_B_BIT (1 << PD6)
 
 // Setup macros for common colors to allow modification in a single place. Order: R, G, B
+// Levels are perceptual, lcd.c gamma corrects them into PWM duty cycles
 #define LCD_COLOR_WHITE  255, 255, 255
-#define LCD_COLOR_YELLOW 255, 255, 100
+#define LCD_COLOR_YELLOW 255, 255, 167
 #define LCD_COLOR_RED    255, 0,   0
 
+/*
+    Backlight animation: the TIMER2_OVF interrupt (450 Hz, the PWM period of Timer0 and Timer2)
+    steps fades and pulses and writes the gamma corrected, brightness scaled levels to the OCRs.
+    It turns itself off once nothing is animating, so a steady backlight costs no cycles.
+    While animating it takes ~150 cycles per tick, under 1% of the CPU
+*/
+#define LCD_FADE_HZ (7372800/64/256)
+#define LCD_PULSE_DEPTH 192 // How far a pulse dims the backlight, 0-255
+
+/*
+    Layouts: the constant text of a group of rows lives in flash and only the dynamic fields
+    are formatted, straight into the frame buffer. A slot's format function writes 'width'
+    characters, or returns 0 without writing to leave the previous ones on the screen
+*/
+
+typedef uint8_t (*lcd_format_t)(char *str);
+
+/*
+    Custom glyphs: a glyph set is an array of up to 8 glyphs in flash, 8 rows of 5 pixels each.
+    Glyph i of a set is loaded into CGRAM slot i and shown by character code LCD_GLYPH(i),
+    which can be used in strings unlike code 0. lcd_glyphs_load() remembers which glyph is in
+    each slot and only rewrites the ones that differ, so switching between pages that share a
+    set costs no CGRAM traffic
+*/
+#define LCD_GLYPHS 8
+#define LCD_GLYPH(i) (0x08 + (i)) // Codes 0x08-0x0F show CGRAM 0-7
+
+typedef const uint8_t lcd_glyph_t[8];
+
+typedef struct {
+    uint8_t row;
+    uint8_t col;
+    uint8_t width;
+    lcd_format_t format;
+} lcd_slot_t;
+
+typedef struct {
+    uint8_t first_row;          // First row drawn by the layout
+    uint8_t rows;               // Number of rows drawn by the layout
+    const char *text;           // rows*LCD_COLS characters of constant text in flash
+    const lcd_slot_t *slots;    // Dynamic fields in flash
+    uint8_t slot_count;
+    const lcd_glyph_t *glyphs;  // Glyph set the layout needs in CGRAM, NULL for none
+    uint8_t glyph_count;
+} lcd_layout_t;
+
 void lcd_init(void);
+uint8_t lcd_init_step(void);
 void lcd_clear(void);
 void lcd_home(void);
 void lcd_moveto(uint8_t r, uint8_t c);
@@ -26,5 +118,17 @@ void lcd_stringout(const char *str);
 void lcd_charout(char ch);
 void lcd_stringnout(const char *str, uint8_t max);
 void lcd_set_rgb(uint8_t r, uint8_t g, uint8_t b);
+void lcd_fade_rgb(uint8_t r, uint8_t g, uint8_t b, uint16_t ms);
+void lcd_pulse(uint16_t period_ms);
+void lcd_set_brightness(uint8_t level);
+uint8_t lcd_glyphs_load(const lcd_glyph_t *glyphs, uint8_t count);
+void lcd_bigdigit(char *str, uint8_t digit, uint8_t row);
+
+extern const lcd_glyph_t lcd_bigdigit_glyphs[] PROGMEM;
+#define LCD_BIGDIGIT_GLYPHS 7
+
+// Frame buffer: draw the next screen with lcd_layout_draw(), then lcd_frame_commit() sends only the changed cells
+void lcd_layout_draw(const lcd_layout_t *layout);
+uint8_t lcd_frame_commit(void);
 
 #endif
\ No newline at end of file
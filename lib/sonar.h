@@ -0,0 +1,37 @@
+#ifndef SONAR_H
+#define SONAR_H
+
+#include <stdint.h>
+
+/*
+	Sonar backends, chosen with SONAR_PW:
+	0: the MaxBotix analog output (Vcc/512 per inch) converted on SONAR_CHAN by the ADC scan,
+	   10 bits for ~2 counts per inch, more with ADC_OVERSAMPLE_BITS
+	1: the pulse width output (147us per inch) wired to the same pin, PC3. Its pin change
+	   interrupt stamps both edges with the free running Timer1 of the clock (1.085us per tick),
+	   so a pulse is measured to ~0.01 inch without any polling. The ADC scan still paces and
+	   filters the sonar slot, taking the last pulse instead of a conversion
+	ICP1 would capture the edges in hardware, but its pin (PB0) drives the LCD's RS line. Here an
+	edge waits for at most the longest other interrupt, ~200 cycles or ~0.2 inch
+	Readings are in SONAR_PER_INCH units before sonar_reading() divides them down to inches
+*/
+#ifndef SONAR_PW
+#define SONAR_PW 0
+#endif
+
+#if SONAR_PW
+#define SONAR_PER_INCH 16
+#define SONAR_PW_BIT (1 << PC3)
+#define SONAR_PW_TICKS(in) ((in)*147UL*9216/10000)	// Timer1 ticks of a pulse, no casts so #if can use it
+#define SONAR_PW_MIN SONAR_PW_TICKS(5)		// Shortest pulse taken, the sensor reports 6 inches and up
+#define SONAR_PW_MAX SONAR_PW_TICKS(254)	// Longest pulse taken, the sensor reports 254 inches at most
+// Ticks to SONAR_PER_INCH units: 16/135.5 ~= 121/1024, within 0.05%
+#define SONAR_PW_SCALE(ticks) (((ticks)*121UL) >> 10)
+
+void sonar_init(void);
+uint16_t sonar_pw(void);
+#else
+#define SONAR_PER_INCH (2 << ADC_OVERSAMPLE_BITS)	// 2 counts per inch at 10 bits, see adc.h
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef TTC_H
+#define TTC_H
+
+#include <stdint.h>
+
+/*
+	Time to collision from the filtered sonar distance
+	ttc_update() takes every new scan of the ADC (one per ADC_SAMPLE_MS, timestamped by its
+	sequence number, so skipped scans don't skew the slope) into a ring of TTC_WINDOW samples.
+	The closing speed is the distance lost between the oldest and the newest sample over the
+	time between them (in SONAR_PER_INCH units, the full resolution of the sonar backend), and
+	the time to collision is the newest distance over that speed:
+	  ttc = distance * dt / (oldest distance - distance)
+	One 32/16 bit division per sample, ~800 cycles (~0.11ms) at 7.3728 MHz
+
+	Closing speeds below TTC_MIN_SPEED are treated as noise and above TTC_MAX_SPEED as a jump.
+	An object entering the beam is also a jump, which the ADC average smears into a flat part,
+	a fast drop and a slow tail, so every quarter of the window must close at least half its
+	share of the distance and both halves at speeds within a factor of 1.5. A real approach is
+	steady enough for that, the sonar's 49ms updates put 3 to 4 steps in each half
+	Latency: the window has to fill with closing samples, ~320ms from the start of an approach
+*/
+#define TTC_WINDOW 32		// Samples in the slope, a power of 2. 310ms between oldest and newest
+#define TTC_MIN_SPEED 20	// Inches per second, ~0.5 m/s
+#define TTC_MAX_SPEED 1200	// Inches per second, ~30 m/s
+#define TTC_NONE 0xFFFF		// ttc_ms() when not closing
+
+void ttc_update(void);
+uint16_t ttc_ms(void);
+
+#endif
@@ -1,9 +1,51 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <string.h>
 
 #include "adc.h"
 
+// Private functions for adc.c
+uint16_t adc_sample(uint8_t channel);
+uint16_t adc_median(const uint16_t* hist);
+
+const uint8_t _adc_scan[] PROGMEM = ADC_SCAN;
+#define ADC_SCAN_COUNT sizeof(_adc_scan)
+
+volatile uint16_t _adc_buf[2][ADC_SCAN_COUNT];	// Published and back half of the results
+volatile uint8_t _adc_front = 0;	// Half of _adc_buf holding the last complete scan
+volatile uint8_t _adc_index = ADC_SCAN_COUNT;	// Index in ADC_SCAN of the conversion in progress, none before the scan
+volatile uint8_t _adc_seq = 0;		// Scans completed, wraps around
+
+// Filter state, only used by ADC_vect
+#if ADC_OVERSAMPLE_BITS
+uint16_t _adc_sum = 0;				// Sum of the burst so far
+uint8_t _adc_burst = 0;				// Conversions of the burst so far
+#endif
+#if ADC_MEDIAN > 1
+uint16_t _adc_hist[ADC_SCAN_COUNT][ADC_MEDIAN];	// Last ADC_MEDIAN raw samples of each channel
+uint8_t _adc_hist_pos = 0;			// Slot of the next sample, shared as all channels advance together
+#endif
+#if ADC_EMA_SHIFT
+uint16_t _adc_ema[ADC_SCAN_COUNT];	// Moving average of each channel, scaled by 2^ADC_EMA_SHIFT
+#endif
+
+// Slots that convert their channel, the sonar slot only paces the pulse width with its triggered conversion
+#if SONAR_PW
+#define ADC_CONVERTS(i) ((i) != ADC_SONAR)
+#else
+#define ADC_CONVERTS(i) 1
+#endif
 
 void adc_init() {
+	uint8_t i;
+	uint8_t channel;
+	uint16_t sample;
+#if ADC_MEDIAN > 1
+	uint8_t j;
+#endif
+
 	// Initialize the ADC
 	ADMUX &= ~(1<<REFS1);	//Set REF bits to AVCC (REFS1=0 and REFS0=1)
 	ADMUX |= (1<<REFS0);
@@ -14,21 +56,176 @@ void adc_init() {
 	ADCSRA &= ~(1<<ADPS0);              // 7.37MHz clock turns to 115kHz which is within 50kHz-200kHz clock for ADC
 
 	ADCSRA |= (1<<ADEN);    //Enable ADC
+#if SONAR_PW
+	sonar_init();
+#endif
+
+	// Fill both halves with a first scan, so readings are valid from the start
+	for(i = 0; i < ADC_SCAN_COUNT; i++) {
+		channel = pgm_read_byte(&_adc_scan[i]);
+		DIDR0 |= (1 << channel);	// Digital input buffer off, it only wastes current on an analog pin
+#if SONAR_PW
+		if(i == ADC_SONAR)
+			sample = sonar_pw();
+		else
+#endif
+		sample = adc_sample(channel);
+		_adc_buf[0][i] = _adc_buf[1][i] = sample;
+#if ADC_MEDIAN > 1
+		for(j = 0; j < ADC_MEDIAN; j++)
+			_adc_hist[i][j] = sample;
+#endif
+#if ADC_EMA_SHIFT
+		_adc_ema[i] = sample << ADC_EMA_SHIFT;
+#endif
+	}
+
+	// From now on each Timer1 compare B match samples the next channel
+	ADMUX = (ADMUX & 0xF0) | pgm_read_byte(&_adc_scan[0]);
+	_adc_index = 0;
+	ADCSRB = (1<<ADTS2)|(1<<ADTS0);		// Auto trigger source Timer1 compare B
+	ADCSRA |= (1<<ADATE)|(1<<ADIE);
+}
+
+/*
+	Returns the last sample of the channel at index in ADC_SCAN
+*/
+uint16_t adc_read(uint8_t index) {
+	return _adc_buf[_adc_front][index];
 }
 
+/*
+	Returns the number of scans completed, which changes once every channel has a new sample
+*/
+uint8_t adc_sequence(void) {
+	return _adc_seq;
+}
+
+/*
+	Idle until the next scan is published, at most ADC_SAMPLE_MS
+	Only the CPU sleeps, so the conversions run without its noise. Interrupts must be enabled
+*/
+void adc_wait(void) {
+	uint8_t seq = _adc_seq;
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	while(_adc_seq == seq)
+		sleep_mode();
+}
+
+/*
+	Returns the light level in 10 bit units, adc_read(ADC_LIGHT) has the oversampled bits
+*/
+uint16_t light_reading() {
+	return adc_read(ADC_LIGHT) >> ADC_OVERSAMPLE_BITS;
+}
+
+uint16_t sonar_reading() {
+	return adc_read(ADC_SONAR)/SONAR_PER_INCH;
+}
+
+/*
+	Convert a channel ADC_OVERSAMPLE times, waiting for the result. Only used before the scan starts
+	With ADC_SLEEP each conversion runs in ADC noise reduction sleep, which stops the clock, so
+	this must not be used once the GPS is talking. Interrupts are enabled for the wake up
+*/
 uint16_t adc_sample(uint8_t channel) {
+	uint16_t sum = 0;
+	uint8_t n;
+#if ADC_SLEEP
+	uint8_t sreg = SREG;
+#endif
+
 	ADMUX &= 0xF0; //Clear mux bits
 	ADMUX |= channel&0x0F; //Set channel
-	ADCSRA |= (1<<ADSC); //Start conversion
-	while(ADCSRA&(1<<ADSC));
-	uint16_t result=ADC;
-	return result;
+#if ADC_SLEEP
+	set_sleep_mode(SLEEP_MODE_ADC);
+	ADCSRA |= (1<<ADIE);
+	sei();
+#endif
+	for(n = 0; n < ADC_OVERSAMPLE; n++) {
+#if ADC_SLEEP
+		sleep_mode(); // Going to sleep starts the conversion, ADC_vect wakes us up
+#else
+		ADCSRA |= (1<<ADSC); //Start conversion
+#endif
+		while(ADCSRA&(1<<ADSC)); // Also when another interrupt woke us up first
+		sum += ADC;
+	}
+#if ADC_SLEEP
+	ADCSRA &= ~(1<<ADIE);
+	SREG = sreg;
+#endif
+	return sum >> ADC_OVERSAMPLE_BITS;
 }
 
-uint16_t light_reading() {
-	return adc_sample(LIGHT_CHAN);
+#if ADC_MEDIAN > 1
+/*
+	Returns the median of the ADC_MEDIAN samples in hist
+	Sorting networks from N. Devillard, "Fast median search: an ANSI C implementation"
+*/
+#define ADC_SORT(a, b) if(v[a] > v[b]) { t = v[a]; v[a] = v[b]; v[b] = t; }
+uint16_t adc_median(const uint16_t* hist) {
+	uint16_t v[ADC_MEDIAN];
+	uint16_t t;
+	memcpy(v, hist, sizeof(v));
+#if ADC_MEDIAN == 3
+	ADC_SORT(0, 1); ADC_SORT(1, 2); ADC_SORT(0, 1);
+	return v[1];
+#else
+	ADC_SORT(0, 1); ADC_SORT(3, 4); ADC_SORT(0, 3);
+	ADC_SORT(1, 4); ADC_SORT(1, 2); ADC_SORT(2, 3);
+	ADC_SORT(1, 2);
+	return v[2];
+#endif
 }
+#endif
 
-uint16_t sonar_reading() {
-	return adc_sample(SONAR_CHAN)/2;
-}
\ No newline at end of file
+/*
+	Conversion complete: add it to the burst, then filter and store the sample and select the next
+	channel for the next trigger. The scan is published by swapping halves once its last channel is in
+	The median and the average take ~150 cycles per sample
+*/
+ISR(ADC_vect) {
+	uint8_t i = _adc_index;
+	uint16_t sample = ADC;
+#if ADC_SLEEP
+	if(i == ADC_SCAN_COUNT)
+		return; // adc_sample() is converting, it only needs the wake up
+#endif
+#if ADC_OVERSAMPLE_BITS
+	if(ADC_CONVERTS(i)) {
+		_adc_sum += sample;
+		if(++_adc_burst < ADC_OVERSAMPLE) {
+			ADCSRA |= (1<<ADSC); // Rest of the burst right away, only its first conversion waits for the trigger
+			return;
+		}
+		sample = _adc_sum >> ADC_OVERSAMPLE_BITS;
+		_adc_sum = 0;
+		_adc_burst = 0;
+	}
+#endif
+#if SONAR_PW
+	if(i == ADC_SONAR)
+		sample = sonar_pw();
+#endif
+#if ADC_MEDIAN > 1
+	_adc_hist[i][_adc_hist_pos] = sample;
+	sample = adc_median(_adc_hist[i]);
+#endif
+#if ADC_EMA_SHIFT
+	_adc_ema[i] += sample - (_adc_ema[i] >> ADC_EMA_SHIFT);
+	sample = _adc_ema[i] >> ADC_EMA_SHIFT;
+#endif
+	_adc_buf[_adc_front ^ 1][i] = sample;
+	if(++i == ADC_SCAN_COUNT) {
+		i = 0;
+		_adc_front ^= 1;
+		_adc_seq++;
+#if ADC_MEDIAN > 1
+		if(++_adc_hist_pos == ADC_MEDIAN)
+			_adc_hist_pos = 0;
+#endif
+	}
+	_adc_index = i;
+	ADMUX = (ADMUX & 0xF0) | pgm_read_byte(&_adc_scan[i]);
+}
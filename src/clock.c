@@ -0,0 +1,41 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "clock.h"
+
+volatile uint32_t _clock_ms = 0;
+
+/***
+    PUBLIC FUNCTIONS
+***/
+
+/*
+	Start the clock, interrupts must be enabled for it to run
+*/
+void clock_init(void) {
+	TCCR1A = 0;
+	TCCR1B = (1 << CS11);	// Free running at FREQ/8
+	OCR1B = TCNT1 + CLOCK_TICKS;
+	TIFR1 = (1 << OCF1B);
+	TIMSK1 |= (1 << OCIE1B);
+}
+
+/*
+	Returns the ms since clock_init(), in steps of CLOCK_TICK_MS
+*/
+uint32_t clock_ms(void) {
+	uint32_t ms;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = _clock_ms;
+	}
+	return ms;
+}
+
+/*
+	Timer interrupt that advances the clock, OCR1B moves along with the free running counter
+*/
+ISR(TIMER1_COMPB_vect) {
+	OCR1B += CLOCK_TICKS;
+	_clock_ms += CLOCK_TICK_MS;
+}
@@ -0,0 +1,88 @@
+#include "fmt.h"
+
+// Private functions for fmt.c
+uint8_t fmt_next_digit(uint32_t* value);
+
+/***
+    PUBLIC FUNCTIONS
+***/
+
+/*
+	Write a number 0-99 as two digits
+*/
+void fmt_2digits(char* str, uint8_t value) {
+	str[0] = '0' + value/10;
+	str[1] = '0' + value%10;
+}
+
+/*
+	Write a number of seconds as "HH:MM:SS"
+*/
+void fmt_hms(char* str, uint16_t seconds) {
+	uint8_t hours = seconds/3600;
+	seconds %= 3600;
+	fmt_2digits(str, hours);
+	str[2] = ':';
+	fmt_2digits(str+3, seconds/60);
+	str[5] = ':';
+	fmt_2digits(str+6, seconds%60);
+}
+
+/*
+	Write 'value' right-aligned in 'width' characters, padded on the left with 'pad'
+	Use '0' for zero-padded fields and ' ' for right-aligned ones
+*/
+void fmt_uint(char* str, uint8_t width, uint32_t value, char pad) {
+	int8_t i = width-1;
+	do {
+		str[i--] = '0' + fmt_next_digit(&value);
+	} while(value && i >= 0);
+	while(i >= 0)
+		str[i--] = pad;
+}
+
+/*
+	Write 'value' with 'decimals' decimal places right-aligned in 'width' characters
+	e.g. -1234 with 1 decimal in 7 characters is " -123.4"
+	At least one digit is written before the decimal point
+*/
+void fmt_fixed(char* str, uint8_t width, int32_t value, uint8_t decimals) {
+	uint8_t negative = (value < 0);
+	uint32_t magnitude = negative?-(uint32_t)value:(uint32_t)value;
+	int8_t i = width-1;
+	while(decimals && i >= 0) {
+		str[i--] = '0' + fmt_next_digit(&magnitude);
+		if(--decimals == 0 && i >= 0)
+			str[i--] = '.';
+	}
+	if(i < 0)
+		return;
+	do {
+		str[i--] = '0' + fmt_next_digit(&magnitude);
+	} while(magnitude && i >= 0);
+	if(negative && i >= 0)
+		str[i--] = '-';
+	while(i >= 0)
+		str[i--] = ' ';
+}
+
+/***
+    PRIVATE FUNCTIONS
+***/
+
+/*
+	Divide 'value' by 10 and return the remainder
+	Values that fit in 16 bits use the much faster 16 bit division
+*/
+uint8_t fmt_next_digit(uint32_t* value) {
+	uint8_t digit;
+	if(*value <= 0xFFFF) {
+		uint16_t v = *value;
+		digit = v%10;
+		*value = v/10;
+	} else {
+		digit = *value%10;
+		*value /= 10;
+	}
+	return digit;
+}
@@ -1,37 +1,231 @@
+#include <util/delay.h>
+
 #include "gps.h"
+#include "fmt.h"
 
 // Private functions for gps.c
-void gps_stringout(const char* str);
 void gps_charout(char ch);
-uint8_t gps_checksum_check(const char* str, uint8_t length);
+void gps_command_start(const char* str);
+char gps_tx_next(void);
+void gps_tx_end(void);
+uint8_t gps_timed_out(void);
+uint8_t gps_epoch(void);
+void gps_epoch_add(uint8_t sentence);
 int8_t hex_to_int(char c);
 
-uint8_t gps_set_time(const char* str);
-uint8_t gps_set_lat(const char* str);
-uint8_t gps_set_long(const char* str);
-uint8_t gps_set_alt(const char* str);
-uint8_t gps_set_speed(const char* str);
-uint8_t gps_set_direction(const char* str);
+uint8_t gps_sentence_type(const char* str);
+uint8_t gps_parse_field(uint8_t sentence, uint8_t index, const char* str, uint8_t len);
+uint8_t gps_set_valid(uint16_t bit, uint8_t ok);
+uint8_t gps_parse_rmc(uint8_t index, const char* str, uint8_t len);
+uint8_t gps_parse_vtg(uint8_t index, const char* str, uint8_t len);
+uint8_t gps_parse_gga(uint8_t index, const char* str, uint8_t len);
+uint8_t gps_parse_gsa(uint8_t index, const char* str, uint8_t len);
+uint8_t gps_parse_gsv(uint8_t index, const char* str, uint8_t len);
+uint8_t gps_parse_zda(uint8_t index, const char* str, uint8_t len);
+#if GPS_STREAM
+void gps_stream_char(char ch);
+void gps_stream_field(void);
+void gps_stream_abort(void);
+#endif
+#if GPS_BINARY
+uint8_t gps_binary_char(uint8_t byte);
+void gps_binary_fix(void);
+#endif
+
+uint8_t gps_parse_fixed(const char* str, uint8_t len, uint8_t decimals, int32_t* value);
+uint8_t gps_parse_2digits(const char* str);
+uint8_t gps_parse_coord(const char* str, uint8_t len, uint8_t digits, int32_t* coord);
+
+uint8_t gps_set_time(const char* str, uint8_t len);
+uint8_t gps_set_lat(const char* str, uint8_t len);
+uint8_t gps_set_long(const char* str, uint8_t len);
+uint8_t gps_set_alt(const char* str, uint8_t len);
+uint8_t gps_set_speed(const char* str, uint8_t len);
+uint8_t gps_set_direction(const char* str, uint8_t len);
 uint8_t gps_set_date(const char* str);
+uint8_t gps_set_count(const char* str, uint8_t len, uint8_t* count);
+uint8_t gps_set_dop(const char* str, uint8_t len, uint16_t* dop);
+
+void gps_format_coord(char* str, int32_t coord, uint8_t digits, char pos, char neg);
+uint8_t gps_format_date(char* str);
+uint8_t gps_format_time(char* str);
+uint8_t gps_format_lat(char* str);
+uint8_t gps_format_long(char* str);
+uint8_t gps_format_alt(char* str);
+uint8_t gps_format_speed(char* str);
+uint8_t gps_format_direction(char* str);
+uint8_t gps_format_big_speed(char* str, uint8_t row);
+uint8_t gps_format_big_speed_top(char* str);
+uint8_t gps_format_big_speed_bottom(char* str);
+
+#if GPS_BINARY
+// Payload of a DIYDrones MediaTek binary packet, little endian like the AVR
+typedef struct __attribute__((packed)) {
+	int32_t lat;			// Latitude in 1e-7 degrees
+	int32_t lon;			// Longitude in 1e-7 degrees
+	int32_t alt;			// Altitude in cm
+	int32_t speed;			// Ground speed in cm/s
+	int32_t course;			// Course in 0.01 degrees
+	uint8_t sats;			// Satellites used in the fix
+	uint8_t fix_type;		// 1 - No fix, 2 - 2D, 3 - 3D, 6 - 2D+SBAS, 7 - 3D+SBAS
+	uint32_t date;			// ddmmyy
+	uint32_t time;			// hhmmssmmm
+	uint16_t hdop;			// Horizontal dilution of precision in 0.01
+} gps_binary_t;
+#endif
 
-volatile uint8_t _new_msg = 0;
-volatile char _line1[MAX_SENTENCE_LEN];
-volatile char _line2[MAX_SENTENCE_LEN];
-volatile char* _buff_line = _line1;
-volatile char* _last_line = _line2;
+#if GPS_STREAM
+// Raw characters from the RX interrupt (producer) waiting for gps_update() (consumer)
+volatile char _fifo[GPS_FIFO_SIZE];
+volatile uint8_t _fifo_head = 0;
+volatile uint8_t _fifo_tail = 0;
+volatile uint16_t _fifo_dropped = 0;	// Characters discarded because the FIFO was full
+volatile uint8_t _fifo_high_water = 0;	// Most characters ever waiting at once
+
+// Streaming parser state, only used by gps_update()
+uint8_t _stream_state = 0;		// STREAM_* state
+uint8_t _sentence = 0;			// SENTENCE_* being parsed, 0 until the address is known
+uint8_t _parsing = 0;			// Cleared once the remaining fields of the sentence are not needed
+uint8_t _field_idx = 0;			// Index of the field being received
+uint8_t _field_len = 0;			// Characters in _field
+char _field[GPS_FIELD_LEN];		// Field being received
+uint8_t _parity = 0;			// Running XOR of the characters between '$' and '*'
+uint8_t _checksum = 0;			// Checksum received after '*'
+gps_fix_t _fix_scratch;			// Fix the sentence is parsed into, copied to gps_fix once its checksum matches
+#if GPS_BINARY
+uint8_t _bin_state = 0;			// BINARY_* state, or payload bytes received
+uint8_t _bin_ck_a = 0;			// Fletcher checksum of the length and payload
+uint8_t _bin_ck_b = 0;
+gps_binary_t _bin_packet;		// Payload being received
+#endif
+#else
+// Ring of sentences between the RX interrupt (producer) and the main loop (consumer)
+// The interrupt fills _ring[_ring_head] and publishes it by advancing _ring_head,
+// gps_acquire() lends out _ring[_ring_tail] and gps_release() frees it by advancing _ring_tail
+gps_sentence_t _ring[GPS_RING_SLOTS];
+volatile uint8_t _ring_head = 0;
+volatile uint8_t _ring_tail = 0;
+volatile uint16_t _ring_dropped = 0;	// Sentences discarded because the ring was full
+volatile uint8_t _ring_high_water = 0;	// Most sentences ever waiting at once
 volatile uint8_t _buff_idx = 0;
 volatile uint8_t _start_flag = 0;
-volatile uint8_t _line_len = 0;
 
-uint8_t _valid_data = 0;
-volatile uint8_t _msgs_elapsed = 0; //Tracks messages receieved since last valid location
+// Checksum state tracked by the RX interrupt while a sentence arrives
+volatile uint8_t _parity = 0;	// Running XOR of the characters between '$' and '*'
+volatile uint8_t _checksum = 0;	// Checksum received after '*'
+volatile uint8_t _cs_state = 0;	// Checksum digits received after '*' (CS_NONE before '*')
+#endif
+
+gps_fix_t gps_fix;
+// Fix the field parsers write: sentences in the ring were checked by the RX interrupt, streamed ones
+// are only checked after their last field, so they go into a scratch copy until then
+#if GPS_STREAM
+#define PARSED_FIX _fix_scratch
+#else
+#define PARSED_FIX gps_fix
+#endif
+int32_t _coord = 0;				// Latitude or longitude waiting for its hemisphere field
+
+// Sentences are grouped into one epoch per fix by their UTC time
+uint32_t _epoch_time = 0;		// Time of the current epoch, packed as hh:mm:ss.cs bytes
+uint8_t _epoch_seen = 0;		// SENTENCE_* bits received for the current epoch
+uint8_t _epoch_ready = 0;		// Set when an epoch is complete, cleared by gps_epoch()
+volatile uint16_t _msgs_elapsed = 0; //Tracks messages receieved since last valid location
 volatile uint16_t elapsedTime = 0;
 
+// Command being sent, by USART_UDRE_vect or by polling in gps_init(), NULL when the transmitter is idle
+const char* volatile _tx_cmd = NULL;
+uint8_t _tx_state = 0;			// TX_* state
+uint8_t _tx_parity = 0;			// XOR of the command characters sent so far
+
+// Values for _tx_state, the command is framed as $<command>*<checksum>\r\n
+#define TX_START   0
+#define TX_BODY    1
+#define TX_CS1     2
+#define TX_CS2     3
+#define TX_CR      4
+#define TX_LF      5
+
+// gps_init_step() progress
+uint8_t _init_state = 0;
+
+// Values for _init_state
+#define INIT_USART   0	// USART not set up yet
+#define INIT_BAUD    1	// PMTK251 sent, waiting for it to leave the shift register
+#define INIT_SWITCH  2	// Waiting for the module to switch to GPS_BAUD
+#define INIT_OUTPUT  3	// Next sends PMTK314
+#define INIT_BINARY  4	// Next sends PGCMD,16
+#define INIT_RATE    5	// Next sends PMTK220
+#define INIT_DONE    6
+
+#define GPS_SWITCH_MS 100	// Time the module needs to change its baud rate
+
 // Determines what gps_parse() should return on an error
-#define PARSE_ERROR_CODE (_msgs_elapsed >= 60)?-1:_valid_data
+#define PARSE_ERROR_CODE gps_timed_out()?-1:(gps_fix.valid & VALID_LINES)
+
+// _epoch_seen value once the current epoch has been reported
+#define EPOCH_REPORTED 0xFF
+
+// Stringify the value of a macro
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+// PMTK314 sentence output rates, in fixes per sentence, generated from gps_config.h
+// Fields: GLL, RMC, VTG, GGA, GSA, GSV, 11 unused, ZDA, MCHN
+#define GPS_OUTPUT_CMD "PMTK314,0," STR(GPS_USE_RMC) "," STR(GPS_USE_VTG) "," STR(GPS_USE_GGA) "," \
+	STR(GPS_USE_GSA) "," STR(GPS_USE_GSV) ",0,0,0,0,0,0,0,0,0,0,0," STR(GPS_USE_ZDA) ",0"
+
+// Sentences that carry a UTC time and can be grouped into epochs
+#define SENTENCES_WITH_TIME (SENTENCE_RMC | SENTENCE_GGA | SENTENCE_ZDA)
+
+// PMTK220 fix interval for GPS_RATE_HZ
+#if GPS_RATE_HZ == 10
+#define GPS_RATE_CMD "PMTK220,100"
+#elif GPS_RATE_HZ == 5
+#define GPS_RATE_CMD "PMTK220,200"
+#else
+#define GPS_RATE_CMD "PMTK220,1000"
+#endif
+
+// Valid bits that gps_parse() reports, the rest only matter to users of gps_fix
+#define VALID_LINES (VALID_LINE_0 | VALID_LINE_1 | VALID_LINE_3)
+
+// Next slot index after i in the sentence ring
+#define RING_NEXT(i) (((i)+1 == GPS_RING_SLOTS)?0:(i)+1)
+
+// Keep the compiler from moving ring slot accesses across head/tail updates
+#define MEMORY_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+// Next index after i in the character FIFO
+#define FIFO_NEXT(i) (((i)+1) & (GPS_FIFO_SIZE-1))
+
+// Values for _stream_state
+#define STREAM_IDLE  0	// Waiting for '$'
+#define STREAM_FIELD 1	// Receiving fields
+#define STREAM_CS1   2	// Waiting for the first checksum digit
+#define STREAM_CS2   3	// Waiting for the second checksum digit
+
+// Values for _bin_state, payload bytes are counted from BINARY_PAYLOAD
+#define BINARY_IDLE    0	// Waiting for 0xD1
+#define BINARY_SYNC    1	// Waiting for 0xDD
+#define BINARY_LEN     2	// Waiting for the payload length
+#define BINARY_PAYLOAD 3
+#define BINARY_CK_A    (BINARY_PAYLOAD+sizeof(gps_binary_t))
+#define BINARY_CK_B    (BINARY_CK_A+1)
+
+#define BINARY_SYNC1 0xD1
+#define BINARY_SYNC2 0xDD
+
+// Values for _cs_state
+#define CS_NONE  0xFF	// '*' not received yet
+#define CS_ERROR 0xFE	// Malformed checksum digits
+
+// Start and length of field i in the sentence being parsed
+#define FIELD(i) (s->text+s->field[i])
+#define FIELD_LEN(i) (s->field[(i)+1]-s->field[i]-1)
 
 /*
-Format of 20x4 LCD screen
+Format of 20x4 LCD screen, built from the layouts below
 Row 3 will be toggled between speed, altitude, and direction
 Rows 1&2 will switch between current position and elapsed time
 
@@ -45,19 +239,58 @@ Rows 1&2 will switch between current position and elapsed time
 3|Direction:    NW    |3
 1|Elapsed Time:       |1
 2|      xx:xx:xx      |2
+1|    ### ### ###     |1  Big speed, 3x2 character digits
+2|    ### ### ### mph |2
  |====================| 
   01234567890123456789  
 
 */
 
+const char _hex_digits[] PROGMEM = "0123456789ABCDEF";
+
+// Constant text of each layout, kept in flash
 // 0xDF is the character code for displaying a degree symbol on the LCD
-char display_screen[6][21] = {
-	"--/--/--   --:-- GMT",
-	"    --\xDF --.----' -  ",
-	"   ---\xDF --.----' -  ",
-	"Altitude: ----.- m  ",
-	"Speed:    ----.- mph",
-	"Direction:    --    "
+const char _text_time[] PROGMEM      = "--/--/--   --:-- GMT";
+const char _text_location[] PROGMEM  = "    --\xDF --.----' -  "
+									   "   ---\xDF --.----' -  ";
+const char _text_alt[] PROGMEM       = "Altitude: ----.- m  ";
+const char _text_speed[] PROGMEM     = "Speed:    ----.- mph";
+const char _text_direction[] PROGMEM = "Direction:    --    ";
+const char _text_big_speed[] PROGMEM = "                    "
+									   "                mph ";
+
+// Dynamic fields of each layout, only these are formatted from gps_fix
+const lcd_slot_t _slots_time[] PROGMEM = {
+	{0, 0, 8, gps_format_date},
+	{0, 11, 5, gps_format_time}
+};
+const lcd_slot_t _slots_location[] PROGMEM = {
+	{1, 4, 14, gps_format_lat},
+	{2, 3, 15, gps_format_long}
+};
+const lcd_slot_t _slots_alt[] PROGMEM = {
+	{3, 10, 6, gps_format_alt}
+};
+const lcd_slot_t _slots_speed[] PROGMEM = {
+	{3, 10, 6, gps_format_speed}
+};
+const lcd_slot_t _slots_direction[] PROGMEM = {
+	{3, 14, 2, gps_format_direction}
+};
+const lcd_slot_t _slots_big_speed[] PROGMEM = {
+	{1, 4, 11, gps_format_big_speed_top},
+	{2, 4, 11, gps_format_big_speed_bottom}
+};
+
+// Layouts in the order of the line numbers given to gps_layout()
+const lcd_layout_t _layouts[] PROGMEM = {
+	{0, 1, _text_time, _slots_time, 2, NULL, 0},
+	{1, 2, _text_location, _slots_location, 2, NULL, 0},
+	{1, 2, _text_location, _slots_location, 2, NULL, 0},
+	{3, 1, _text_alt, _slots_alt, 1, NULL, 0},
+	{3, 1, _text_speed, _slots_speed, 1, NULL, 0},
+	{3, 1, _text_direction, _slots_direction, 1, NULL, 0},
+	{1, 2, _text_big_speed, _slots_big_speed, 2, lcd_bigdigit_glyphs, LCD_BIGDIGIT_GLYPHS}
 };
 
 /***
@@ -65,380 +298,1112 @@ char display_screen[6][21] = {
 ***/
 
 /*
-    Initializes GPS Serial Communication
+    Initializes GPS Serial Communication, waiting until the module is configured
+    Commands are sent by polling, so interrupts don't need to be enabled yet
 */
 void gps_init(void) {
-	UBRR0 = UBRR; // Set baud rate
-	UCSR0B |= (1 << TXEN0) | (1 << RXEN0); // Enable RX and TX
-	UCSR0C = (3 << UCSZ00); // Async., no parity, 1 stop bit, 8 data bits
-	gps_stringout("$PMTK314,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0*28\n"); // Only receive RMC and GGA sentences
-	gps_stringout("$PMTK220,1000*1F\n"); // Update at 1 Hz frequency
-	// gps_stringout("$PMTK220,200*2C\n"); // Update at 5 Hz frequency
-	UCSR0B |= (1 << RXCIE0); // Enable RX Interrupt
+	uint8_t wait;
+	while((wait = gps_init_step()) != 0) {
+		UCSR0B &= ~(1 << UDRIE0);
+		if(_tx_cmd != NULL) {
+			while(_tx_cmd != NULL)
+				gps_charout(gps_tx_next());
+			gps_tx_end();
+		}
+		while(wait--)
+			_delay_ms(1);
+	}
+}
 
-	EIMSK |= (1 << INT0); // Enable the INT0 interrupt located on PD2
-	EICRA |= (1 << ISC01)|(1 << ISC00); //Set interrupt only on rising edge
+/*
+	Run the next step of the GPS set up without blocking, commands are sent by USART_UDRE_vect
+	Returns the ms to wait before calling again, 0 once the module is configured
+*/
+uint8_t gps_init_step(void) {
+	if(_tx_cmd != NULL)
+		return 1; // Last command is still being sent
+	switch(_init_state) {
+	case INIT_USART:
+		UBRR0 = UBRR; // Set baud rate
+		UCSR0B |= (1 << TXEN0) | (1 << RXEN0); // Enable RX and TX
+		UCSR0C = (3 << UCSZ00); // Async., no parity, 1 stop bit, 8 data bits
+		EIMSK |= (1 << INT0); // Enable the INT0 interrupt located on PD2
+		EICRA |= (1 << ISC01)|(1 << ISC00); //Set interrupt only on rising edge
+#if GPS_BAUD != BAUD || GPS_U2X
+		// Switch to GPS_BAUD as it differs from the power up rate
+		gps_command_start(PSTR("PMTK251," STR(GPS_BAUD)));
+		_init_state = INIT_BAUD;
+		return 1;
+	case INIT_BAUD:
+		// Let the last character leave the shift register before changing the baud rate
+		if((UCSR0A & (1 << TXC0)) == 0)
+			return 1;
+		_init_state = INIT_SWITCH;
+		return GPS_SWITCH_MS;
+	case INIT_SWITCH:
+		UBRR0 = GPS_UBRR;
+#if GPS_U2X
+		UCSR0A = (1 << U2X0); // Assigned, the FE0, DOR0 and UPE0 flags must be written as 0
+#endif
+#endif
+		UCSR0B |= (1 << RXCIE0); // Enable RX Interrupt, the line is at its final baud rate
+		/* fall through */
+	case INIT_OUTPUT:
+		gps_command_start(PSTR(GPS_OUTPUT_CMD)); // Only receive the sentences selected in gps_config.h
+		_init_state = INIT_BINARY;
+		return 1;
+	case INIT_BINARY:
+#if GPS_BINARY
+		gps_command_start(PSTR("PGCMD,16,0,0,0,0,0")); // Binary output, ignored by modules without it so NMEA stays
+		_init_state = INIT_RATE;
+		return 1;
+#endif
+		/* fall through */
+	case INIT_RATE:
+		gps_command_start(PSTR(GPS_RATE_CMD)); // Update at GPS_RATE_HZ
+		_init_state = INIT_DONE;
+		return 1;
+	}
+	return 0;
 }
 
+/*
+	Parse what the GPS has sent since the last call, stopping as soon as a fix is complete so the
+	sentences after it stay queued until the next call. gps_fix is only written by this call, but
+	it holds more than the complete fix when a sentence was lost: that fix is only reported once
+	the first sentence of the next one arrives, and those fields are already in gps_fix
+	Returns 1 once all sentences of a fix have been parsed, so the display is only redrawn once per fix
+*/
+uint8_t gps_update(void) {
+#if GPS_STREAM
+	uint8_t tail = _fifo_tail;
+	while(tail != _fifo_head && !_epoch_ready) {
+#if GPS_BINARY
+		if(!gps_binary_char(_fifo[tail]))
+#endif
+		gps_stream_char(_fifo[tail]);
+		tail = FIFO_NEXT(tail);
+		_fifo_tail = tail; // Hand the character back to the RX interrupt
+	}
+#else
+	const gps_sentence_t* s;
+	while(!_epoch_ready && (s = gps_acquire()) != NULL) {
+		gps_parse(s);
+		gps_release();
+	}
+#endif
+	return gps_epoch();
+}
+
+/*
+	Returns:	-1 if no valid location has been found in GPS_TIMEOUT_MSGS sentences
+				VALID_* bits to indicate which display lines can be formatted from gps_fix
+*/
+int8_t gps_status(void) {
+	return PARSE_ERROR_CODE;
+}
+
+#if !GPS_STREAM
 /*
 	Check if a new message is available
+	Returns the number of sentences waiting to be read
 */
 uint8_t gps_check() {
-	return _new_msg;
+	uint8_t head = _ring_head;
+	uint8_t tail = _ring_tail;
+	return (head >= tail)?(head-tail):(head+GPS_RING_SLOTS-tail);
 }
 
 /*
-	Copy the last transmitted line to str
-	Return length of new line
+	Borrow the oldest unread sentence directly from the ring without copying it
+	The slot is not reused by the RX interrupt until gps_release() is called
+	Return NULL if no sentence is waiting
 */
-uint8_t gps_readline(char* str) {
-	if(_new_msg) {
-		strcpy(str, (char*)_last_line);
-		_new_msg = 0;
-		return _line_len;
+const gps_sentence_t* gps_acquire(void) {
+	uint8_t tail = _ring_tail;
+	if(tail == _ring_head)
+		return NULL;
+	MEMORY_BARRIER();
+	return &_ring[tail];
+}
+
+/*
+	Hand the sentence returned by gps_acquire() back to the RX interrupt
+*/
+void gps_release(void) {
+	uint8_t tail = _ring_tail;
+	if(tail != _ring_head) {
+		MEMORY_BARRIER();
+		_ring_tail = RING_NEXT(tail);
 	}
-	return 0;
 }
 
 /*
-	Parse the NMEA sentence and update display_screen
-	Returns:	-1 if no valid location has been found in 60 sentences (=30 seconds when receiving 2 sentences each second)
-				_valid_data to indicate fields in display_screen are valid
+	Parse the NMEA sentence into gps_fix
+	Returns:	-1 if no valid location has been found in GPS_TIMEOUT_MSGS sentences
+				VALID_* bits to indicate which display lines can be formatted from gps_fix
 */
-int8_t gps_parse(char* str, uint8_t length) {
-	//Check if checksum is accurate
-	if(!gps_checksum_check(str, length))
+int8_t gps_parse(const gps_sentence_t* s) {
+	// Fields and checksum were already found by the RX interrupt
+	uint8_t count = s->count;
+	if(count == 0 || FIELD_LEN(0) != 5)
 		return PARSE_ERROR_CODE;
-	//ptr1 will be at the start of a field, ptr2 will be at the end
-	char* ptr1 = str;
-	char* ptr2 = str;
-	ptr2 = strchr(ptr1, ',');
-
-	if(strncmp(ptr1+2, "GGA", 3) == 0) { 		// Parse GGA sentence
-		// Time field
-		// Format: hhmmss.ss (variable decimal point precision)
-		// hh - hours, mm - minutes, ss.ss - seconds
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2 || ptr2-ptr1 < 6)
-			return PARSE_ERROR_CODE;
-		if(gps_set_time(ptr1))
-			_valid_data |= VALID_TIME;
-		else
-			_valid_data &= ~VALID_TIME;
-
-		_valid_data &= ~VALID_LOC;
-		// Latitude field
-		// Format: ddmm.mmmm,h (variable decimal point precision)
-		// dd - degrees, mm.mmmm - minutes, h - lat. hemisphere (N/S)
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2) return PARSE_ERROR_CODE;
-		ptr2 = strchr(ptr2+1, ',');
-		if(!ptr2 || ptr2-ptr1 < 6)
-			return PARSE_ERROR_CODE;
-		if(!gps_set_lat(ptr1))
-			return PARSE_ERROR_CODE;
-
-		// Longitude field
-		// Format: dddmm.mmmm,h (variable decimal point precision)
-		// ddd - degrees, mm.mmmm - minutes, h - long. hemisphere (E/W)
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2) return PARSE_ERROR_CODE;
-		ptr2 = strchr(ptr2+1, ',');
-		if(!ptr2 || ptr2-ptr1 < 7)
-			return PARSE_ERROR_CODE;
-		if(!gps_set_long(ptr1))
-			return PARSE_ERROR_CODE;
-
-		_valid_data |= VALID_LOC;
-		
-		// Fix quality indicator
-		// Format: f
-		// f - GPS Quality of Signal (0 - No fix, 1 - GPS fix, 2 - DGPS fix)
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2 || ptr1+1!=ptr2 || *ptr1 < '1' || *ptr1 > '9') {
-			_valid_data &= ~VALID_LOC;
-			return PARSE_ERROR_CODE;
-		}
-		_msgs_elapsed = 0;
-
-		// Skip Number of Satellites and HDOP
-		ptr2 = strchr(ptr2+1, ',');
-		if(!ptr2) return PARSE_ERROR_CODE;
-		ptr2 = strchr(ptr2+1, ',');
-		if(!ptr2) return PARSE_ERROR_CODE;
-
-		// Altitude
-		// Format: aa.aa (variable number digits before and after decimal)
-		ptr1 = ptr2+1;
-		if(gps_set_alt(ptr1))
-			_valid_data |= VALID_ALT;
-		else
-			_valid_data &= ~VALID_ALT;
-
-		// Skip the rest of the sentence
-		return _valid_data;
-	} else if(strncmp(ptr1+2, "RMC", 3) == 0) {	// Parse RMC sentence
-		// Time field
-		// Format: hhmmss.ss (variable decimal point precision)
-		// hh - hours, mm - minutes, ss.ss - seconds
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2 || ptr2-ptr1 < 6)
-			return PARSE_ERROR_CODE;
-		if(gps_set_time(ptr1))
-			_valid_data |= VALID_TIME;
-		else
-			_valid_data &= ~VALID_TIME;
-
-		// Validity indicator
-		// Format: f
-		// f - (A - OK, V - Warning)
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2 || ptr1+1!=ptr2 || *ptr1 != 'A')
-			return PARSE_ERROR_CODE;
-
-		_valid_data &= ~VALID_LOC;
-		// Latitude field
-		// Format: ddmm.mmmm,h (variable decimal point precision)
-		// dd - degrees, mm.mmmm - minutes, h - lat. hemisphere (N/S)
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2) return PARSE_ERROR_CODE;
-		ptr2 = strchr(ptr2+1, ',');
-		if(!ptr2 || ptr2-ptr1 < 6)
-			return PARSE_ERROR_CODE;
-		if(!gps_set_lat(ptr1))
-			return PARSE_ERROR_CODE;
-
-		// Longitude field
-		// Format: dddmm.mmmm,h (variable decimal point precision)
-		// ddd - degrees, mm.mmmm - minutes, h - long. hemisphere (E/W)
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2) return PARSE_ERROR_CODE;
-		ptr2 = strchr(ptr2+1, ',');
-		if(!ptr2 || ptr2-ptr1 < 7)
-			return PARSE_ERROR_CODE;
-		if(!gps_set_long(ptr1))
-			return PARSE_ERROR_CODE;
-
-		_valid_data |= VALID_LOC;
-		_msgs_elapsed = 0;
-
-		// Speed field
-		// Format: ss.ss (variable number digits before and after decimal)
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2 || ptr1==ptr2)
-			return PARSE_ERROR_CODE;
-		if(gps_set_speed(ptr1))
-			_valid_data |= VALID_SPD;
-		else
-			_valid_data &= ~VALID_SPD;
-
-		// Direction field
-		// Format ddd.d (variable number after decimal)
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2 || ptr1==ptr2)
-			return PARSE_ERROR_CODE;
-		if(gps_set_direction(ptr1))
-			_valid_data |= VALID_DIR;
-		else
-			_valid_data &= ~VALID_DIR;
-
-		// Date field
-		// Format ddmmyy
-		// d - day, m - month, y - year
-		ptr1 = ptr2+1;
-		ptr2 = strchr(ptr1, ',');
-		if(!ptr2 || ptr2-ptr1 < 6)
-			return PARSE_ERROR_CODE;
-		if(gps_set_date(ptr1))
-			_valid_data |= VALID_DATE;
-		else
-			_valid_data &= ~VALID_DATE;
-
-		// Skip the rest
+
+	uint8_t sentence = gps_sentence_type(s->text);
+	if(sentence == 0)
 		return PARSE_ERROR_CODE;
-	}
+	uint8_t i = 1;
+	while(i < count && gps_parse_field(sentence, i, FIELD(i), FIELD_LEN(i)))
+		i++;
+	gps_epoch_add(sentence);
 	return PARSE_ERROR_CODE;
 }
+#endif
+
+/*
+	Return the number of sentences (characters in GPS_STREAM mode) discarded because the ring was full
+*/
+uint16_t gps_dropped(void) {
+	uint16_t dropped;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+#if GPS_STREAM
+		dropped = _fifo_dropped;
+#else
+		dropped = _ring_dropped;
+#endif
+	}
+	return dropped;
+}
+
+/*
+	Return the most sentences (characters in GPS_STREAM mode) that have been waiting to be read at once
+*/
+uint8_t gps_high_water(void) {
+#if GPS_STREAM
+	return _fifo_high_water;
+#else
+	return _ring_high_water;
+#endif
+}
+
+/*
+	Return the layout that shows display line 'line' (0-5 or GPS_LINE_BIG_SPEED, see the screen
+	format above). Lines 1 and 2 share the location layout
+	Only the fields of the layout that are about to be shown are formatted, when it is drawn
+	with lcd_layout_draw(). Fields of gps_fix that are not valid keep their previous text
+*/
+const lcd_layout_t* gps_layout(uint8_t line) {
+	return &_layouts[line];
+}
 
 /***
     PRIVATE FUNCTIONS
 ***/
 
-uint8_t gps_set_time(const char* str) {
-	display_screen[0][11] = str[0];	// First digit of hour
-	display_screen[0][12] = str[1];	// Second digit of hour
-	display_screen[0][14] = str[2];	// First digit of minute
-	display_screen[0][15] = str[3];	// Second digit of minute
-	return 1;
+/*
+	Check if all sentences of a fix have been parsed since the last call
+	Returns 1 once per epoch
+*/
+uint8_t gps_epoch(void) {
+	uint8_t ready = _epoch_ready;
+	_epoch_ready = 0;
+	return ready;
 }
 
-uint8_t gps_set_lat(const char* str) {
-	display_screen[1][4] = (str[0]=='0')?' ':str[0]; // First digit of degree
-	display_screen[1][5] = str[1];			 		 // Second digit of degree
-	display_screen[1][8] = (str[2]=='0')?' ':str[2]; // First digit of minute
-	display_screen[1][9] = str[3];					 // Second digit of minute
-	str = str+4;
-	uint8_t i = (*str==',')?1:0;
-	while(*str != ',' && i<5) {
-		display_screen[1][10+i] = *str;
-		str++;
-		i++;
+/*
+	Find the SENTENCE_* type from the 5 character address field, ignoring the talker ID
+	Return 0 for sentences that are not parsed
+*/
+uint8_t gps_sentence_type(const char* str) {
+	str += 2;
+#if GPS_USE_RMC
+	if(strncmp_P(str, PSTR("RMC"), 3) == 0)
+		return SENTENCE_RMC;
+#endif
+#if GPS_USE_VTG
+	if(strncmp_P(str, PSTR("VTG"), 3) == 0)
+		return SENTENCE_VTG;
+#endif
+#if GPS_USE_GGA
+	if(strncmp_P(str, PSTR("GGA"), 3) == 0)
+		return SENTENCE_GGA;
+#endif
+#if GPS_USE_GSA
+	if(strncmp_P(str, PSTR("GSA"), 3) == 0)
+		return SENTENCE_GSA;
+#endif
+#if GPS_USE_GSV
+	if(strncmp_P(str, PSTR("GSV"), 3) == 0)
+		return SENTENCE_GSV;
+#endif
+#if GPS_USE_ZDA
+	if(strncmp_P(str, PSTR("ZDA"), 3) == 0)
+		return SENTENCE_ZDA;
+#endif
+	return 0;
+}
+
+/*
+	Parse field 'index' of a sentence into gps_fix
+	Fields are passed in order as soon as each one is complete, so no more than one field needs to be stored
+	Return 0 if the rest of the sentence should be skipped
+*/
+uint8_t gps_parse_field(uint8_t sentence, uint8_t index, const char* str, uint8_t len) {
+	switch(sentence) {
+#if GPS_USE_RMC
+		case SENTENCE_RMC:
+			return gps_parse_rmc(index, str, len);
+#endif
+#if GPS_USE_VTG
+		case SENTENCE_VTG:
+			return gps_parse_vtg(index, str, len);
+#endif
+#if GPS_USE_GGA
+		case SENTENCE_GGA:
+			return gps_parse_gga(index, str, len);
+#endif
+#if GPS_USE_GSA
+		case SENTENCE_GSA:
+			return gps_parse_gsa(index, str, len);
+#endif
+#if GPS_USE_GSV
+		case SENTENCE_GSV:
+			return gps_parse_gsv(index, str, len);
+#endif
+#if GPS_USE_ZDA
+		case SENTENCE_ZDA:
+			return gps_parse_zda(index, str, len);
+#endif
 	}
-	while(i<5) {
-		display_screen[1][10+i] = '0';
-		i++;
+	return 0;
+}
+
+#if GPS_USE_RMC
+/*
+	Parse a field of an RMC sentence (recommended minimum data)
+*/
+uint8_t gps_parse_rmc(uint8_t index, const char* str, uint8_t len) {
+	switch(index) {
+		case 1:
+			// Time field
+			// Format: hhmmss.ss (variable decimal point precision)
+			// hh - hours, mm - minutes, ss.ss - seconds
+			gps_set_valid(VALID_TIME, len >= 6 && gps_set_time(str, len));
+			return (len >= 6);
+		case 2:
+			// Validity indicator
+			// Format: f
+			// f - (A - OK, V - Warning)
+			return (len == 1 && *str == 'A');
+		case 3:
+			// Latitude field
+			// Format: ddmm.mmmm,h (variable decimal point precision)
+			// dd - degrees, mm.mmmm - minutes, h - lat. hemisphere (N/S)
+			PARSED_FIX.valid &= ~VALID_LOC;
+			return gps_parse_coord(str, len, 2, &_coord);
+		case 4:
+			return gps_set_lat(str, len);
+		case 5:
+			// Longitude field
+			// Format: dddmm.mmmm,h (variable decimal point precision)
+			// ddd - degrees, mm.mmmm - minutes, h - long. hemisphere (E/W)
+			return gps_parse_coord(str, len, 3, &_coord);
+		case 6:
+			if(!gps_set_valid(VALID_LOC, gps_set_long(str, len)))
+				return 0;
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				_msgs_elapsed = 0;
+			}
+			return 1;
+		case 7:
+			// Speed field
+			// Format: ss.ss (variable number digits before and after decimal)
+			if(len == 0)
+				return 0;
+			gps_set_valid(VALID_SPD, gps_set_speed(str, len));
+			return 1;
+		case 8:
+			// Direction field
+			// Format ddd.d (variable number after decimal)
+			if(len == 0)
+				return 0;
+			gps_set_valid(VALID_DIR, gps_set_direction(str, len));
+			return 1;
+		case 9:
+			// Date field
+			// Format ddmmyy
+			// d - day, m - month, y - year
+			if(len >= 6)
+				gps_set_valid(VALID_DATE, gps_set_date(str));
+			return 0; // Skip the rest
 	}
-	display_screen[1][17] = str[1];
-	return (str[1] == 'N' || str[1] == 'S');
+	return 0;
 }
+#endif
 
-uint8_t gps_set_long(const char* str) {
-	display_screen[2][3] = (str[0]=='0')?' ':str[0];				// First digit of degree
-	display_screen[2][4] = (str[0]=='0'&&str[1]=='0')?' ':str[1];	// Second digit of degree
-	display_screen[2][5] = str[2];									// Third digit of degree
-	display_screen[2][8] = (str[3]=='0')?' ':str[3];				// First digit of minute
-	display_screen[2][9] = str[4];									// Second digit of minute
-	str = str+5;
-	uint8_t i = (*str==',')?1:0;
-	while(*str != ',' && i<5) {
-		display_screen[2][10+i] = *str;
-		str++;
-		i++;
+#if GPS_USE_VTG
+/*
+	Parse a field of a VTG sentence (course and speed over ground)
+*/
+uint8_t gps_parse_vtg(uint8_t index, const char* str, uint8_t len) {
+	switch(index) {
+		case 1:
+			// True course
+			// Format ddd.d (variable number after decimal)
+			gps_set_valid(VALID_DIR, gps_set_direction(str, len));
+			return 1;
+		case 5:
+			// Speed in knots
+			// Format: ss.ss (variable number digits before and after decimal)
+			gps_set_valid(VALID_SPD, gps_set_speed(str, len));
+			return 0; // Skip km/h and mode
 	}
-	while(i<5) {
-		display_screen[2][10+i] = '0';
-		i++;
+	return 1; // Skip magnetic course and unit fields
+}
+#endif
+
+#if GPS_USE_GGA
+/*
+	Parse a field of a GGA sentence (fix data)
+*/
+uint8_t gps_parse_gga(uint8_t index, const char* str, uint8_t len) {
+	switch(index) {
+		case 1:
+			// Time field
+			// Format: hhmmss.ss (variable decimal point precision)
+			// hh - hours, mm - minutes, ss.ss - seconds
+			gps_set_valid(VALID_TIME, len >= 6 && gps_set_time(str, len));
+			return (len >= 6);
+		case 2:
+			// Latitude field
+			// Format: ddmm.mmmm,h (variable decimal point precision)
+			// dd - degrees, mm.mmmm - minutes, h - lat. hemisphere (N/S)
+			PARSED_FIX.valid &= ~VALID_LOC;
+			return gps_parse_coord(str, len, 2, &_coord);
+		case 3:
+			return gps_set_lat(str, len);
+		case 4:
+			// Longitude field
+			// Format: dddmm.mmmm,h (variable decimal point precision)
+			// ddd - degrees, mm.mmmm - minutes, h - long. hemisphere (E/W)
+			return gps_parse_coord(str, len, 3, &_coord);
+		case 5:
+			return gps_set_valid(VALID_LOC, gps_set_long(str, len));
+		case 6:
+			// Fix quality indicator
+			// Format: f
+			// f - GPS Quality of Signal (0 - No fix, 1 - GPS fix, 2 - DGPS fix)
+			if(len != 1 || *str < '1' || *str > '9') {
+				PARSED_FIX.quality = 0;
+				PARSED_FIX.valid &= ~VALID_LOC;
+				return 0;
+			}
+			PARSED_FIX.quality = *str-'0';
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				_msgs_elapsed = 0;
+			}
+			return 1;
+		case 7:
+			// Number of satellites
+			// Format: nn
+			gps_set_valid(VALID_SATS, gps_set_count(str, len, &PARSED_FIX.sats));
+			return 1;
+		case 8:
+			// HDOP
+			// Format: h.hh (variable number of digits after decimal)
+			gps_set_valid(VALID_HDOP, gps_set_dop(str, len, &PARSED_FIX.hdop));
+			return 1;
+		case 9:
+			// Altitude
+			// Format: aa.aa (variable number digits before and after decimal)
+			gps_set_valid(VALID_ALT, gps_set_alt(str, len));
+			return 0; // Skip the rest of the sentence
 	}
-	display_screen[2][17] = str[1];
-	return (str[1] == 'E' || str[1] == 'W');
+	return 0;
 }
+#endif
 
-uint8_t gps_set_alt(const char* str) {
-	char* ptr = strchr(str, '.');
-	char* end = strchr(str, ',');
-	if(!end || end==str) return 0;
-	if(!ptr || end < ptr) //No decimal
-		ptr = end;
-	uint8_t i = 4;
-	while(i > ptr-str) { //Replace unneeded digits with a space
-		display_screen[3][14-i] = ' ';
-		i--;
+#if GPS_USE_GSA
+/*
+	Parse a field of a GSA sentence (DOP and active satellites)
+*/
+uint8_t gps_parse_gsa(uint8_t index, const char* str, uint8_t len) {
+	switch(index) {
+		case 2:
+			// Fix mode
+			// Format: f
+			// f - (1 - No fix, 2 - 2D fix, 3 - 3D fix)
+			if(len != 1 || *str < '1' || *str > '3') {
+				PARSED_FIX.valid &= ~VALID_MODE;
+				return 0;
+			}
+			PARSED_FIX.mode = *str-'0';
+			PARSED_FIX.valid |= VALID_MODE;
+			return 1;
+		case 15:
+			// PDOP
+			// Format: p.pp (variable number of digits after decimal)
+			gps_set_valid(VALID_DOP, gps_set_dop(str, len, &PARSED_FIX.pdop));
+			return 1;
+		case 16:
+			// HDOP
+			gps_set_valid(VALID_HDOP, gps_set_dop(str, len, &PARSED_FIX.hdop));
+			return 1;
+		case 17:
+			// VDOP
+			if(!gps_set_dop(str, len, &PARSED_FIX.vdop))
+				PARSED_FIX.valid &= ~VALID_DOP;
+			return 0;
 	}
-	while(i > 0) {
-		display_screen[3][14-i] = *str;
-		str++;
-		i--;
+	return 1; // Skip the selection mode and satellite IDs
+}
+#endif
+
+#if GPS_USE_GSV
+/*
+	Parse a field of a GSV sentence (satellites in view)
+	Only the total is kept, the per satellite details are skipped
+*/
+uint8_t gps_parse_gsv(uint8_t index, const char* str, uint8_t len) {
+	if(index == 3) {
+		// Satellites in view
+		// Format: nn
+		gps_set_valid(VALID_VIEW, gps_set_count(str, len, &PARSED_FIX.sats_view));
+		return 0;
 	}
-	
-	if(ptr != end) {
-		ptr++;
-		display_screen[3][15] = *ptr;
-	} else {
-		display_screen[3][15] = '0';
+	return 1; // Skip the message count and number
+}
+#endif
+
+#if GPS_USE_ZDA
+/*
+	Parse a field of a ZDA sentence (time and date)
+*/
+uint8_t gps_parse_zda(uint8_t index, const char* str, uint8_t len) {
+	uint8_t value = (len == 2)?gps_parse_2digits(str):0xFF;
+	switch(index) {
+		case 1:
+			// Time field
+			// Format: hhmmss.ss (variable decimal point precision)
+			gps_set_valid(VALID_TIME, len >= 6 && gps_set_time(str, len));
+			return (len >= 6);
+		case 2:
+			// Day
+			// Format: dd
+			PARSED_FIX.valid &= ~VALID_DATE;
+			PARSED_FIX.day = value;
+			return (value >= 1 && value <= 31);
+		case 3:
+			// Month
+			// Format: mm
+			PARSED_FIX.month = value;
+			return (value >= 1 && value <= 12);
+		case 4:
+			// Year
+			// Format: yyyy
+			if(len == 4 && str[0] == '2' && str[1] == '0') {
+				value = gps_parse_2digits(str+2);
+				if(value <= 99) {
+					PARSED_FIX.year = value;
+					PARSED_FIX.valid |= VALID_DATE;
+				}
+			}
+			return 0; // Skip the local time zone
+	}
+	return 0;
+}
+#endif
+
+/*
+	Set or clear a valid bit of the fix being parsed
+	Returns 'ok' so a field can be stored and checked in one step
+*/
+uint8_t gps_set_valid(uint16_t bit, uint8_t ok) {
+	if(ok)
+		PARSED_FIX.valid |= bit;
+	else
+		PARSED_FIX.valid &= ~bit;
+	return ok;
+}
+
+#if GPS_STREAM
+/*
+	Feed one character to the streaming parser
+	Each field is parsed as soon as its ',' arrives and sentences that are not parsed are skipped
+	without being stored. Fields go into a copy of gps_fix, which replaces gps_fix once the checksum matches
+*/
+void gps_stream_char(char ch) {
+	if(ch == '$') {
+		if(_stream_state != STREAM_IDLE) // Previous sentence was cut off
+			gps_stream_abort();
+		_stream_state = STREAM_FIELD;
+		_sentence = 0;
+		_parsing = 0;
+		_field_idx = 0;
+		_field_len = 0;
+		_parity = 0;
+		if(!(gps_fix.valid & VALID_LOC) && _msgs_elapsed < GPS_TIMEOUT_MSGS)
+			_msgs_elapsed++;
+		return;
+	}
+
+	switch(_stream_state) {
+		case STREAM_FIELD:
+			if(ch == ',' || ch == '*') {
+				gps_stream_field();
+				if(ch == '*') {
+					_checksum = 0;
+					_stream_state = STREAM_CS1;
+					return;
+				}
+			} else if(ch == '\r' || ch == '\n') { // Line ended without a checksum
+				gps_stream_abort();
+				return;
+			} else if(_parsing) {
+				if(_field_len == GPS_FIELD_LEN) { // Longer than any parsed field
+					gps_stream_abort();
+					return;
+				}
+				_field[_field_len++] = ch;
+			} else if(_field_idx == 0 && _field_len < 5) { // Address, kept until the type is known
+				_field[_field_len++] = ch;
+			}
+			_parity ^= ch;
+			break;
+		case STREAM_CS1:
+		case STREAM_CS2: {
+			int8_t digit = hex_to_int(ch);
+			if(digit < 0) {
+				gps_stream_abort();
+				return;
+			}
+			_checksum = (_checksum << 4) | digit;
+			if(_stream_state == STREAM_CS1) {
+				_stream_state = STREAM_CS2;
+			} else if(_checksum == _parity) { // Sentence is complete and valid
+				_stream_state = STREAM_IDLE;
+				if(_sentence) {
+					memcpy(&gps_fix, &_fix_scratch, sizeof(gps_fix_t));
+					gps_epoch_add(_sentence);
+				}
+			} else {
+				gps_stream_abort();
+			}
+			break;
+		}
+	}
+}
+
+/*
+	Handle the field that was just completed by a ',' or '*'
+*/
+void gps_stream_field(void) {
+	if(_field_idx == 0) {
+		// Recognize the sentence from its address, anything else is skipped without storing it
+		_sentence = (_field_len == 5)?gps_sentence_type(_field):0;
+		if(_sentence == 0) {
+			_stream_state = STREAM_IDLE;
+			return;
+		}
+		memcpy(&_fix_scratch, &gps_fix, sizeof(gps_fix_t));
+		_parsing = 1;
+	} else if(_parsing) {
+		_parsing = gps_parse_field(_sentence, _field_idx, _field, _field_len);
+	}
+	_field_idx++;
+	_field_len = 0;
+}
+
+/*
+	Drop the sentence being received, gps_fix never saw its fields
+*/
+void gps_stream_abort(void) {
+	_sentence = 0;
+	_stream_state = STREAM_IDLE;
+}
+#endif
+
+#if GPS_BINARY
+/*
+	Feed one byte to the binary packet parser
+	Return 0 if the byte is not part of a binary packet and should go to the NMEA parser
+*/
+uint8_t gps_binary_char(uint8_t byte) {
+	uint8_t state = _bin_state;
+	if(state == BINARY_IDLE) {
+		if(byte != BINARY_SYNC1)
+			return 0; // 0xD1 never appears in NMEA text
+		_bin_state = BINARY_SYNC;
+		if(_stream_state != STREAM_IDLE) // NMEA sentence was cut off
+			gps_stream_abort();
+		return 1;
 	}
 
+	if(state == BINARY_SYNC) {
+		_bin_state = (byte == BINARY_SYNC2)?BINARY_LEN:BINARY_IDLE;
+	} else if(state == BINARY_LEN) {
+		if(byte != sizeof(gps_binary_t)) {
+			_bin_state = BINARY_IDLE;
+			return 1;
+		}
+		_bin_ck_a = _bin_ck_b = byte;
+		_bin_state = BINARY_PAYLOAD;
+		if(!(gps_fix.valid & VALID_LOC) && _msgs_elapsed < GPS_TIMEOUT_MSGS)
+			_msgs_elapsed++;
+	} else if(state < BINARY_CK_A) {
+		((uint8_t*)&_bin_packet)[state-BINARY_PAYLOAD] = byte;
+		_bin_ck_a += byte;
+		_bin_ck_b += _bin_ck_a;
+		_bin_state = state+1;
+	} else if(state == BINARY_CK_A) {
+		_bin_state = (byte == _bin_ck_a)?BINARY_CK_B:BINARY_IDLE;
+	} else {
+		_bin_state = BINARY_IDLE;
+		if(byte == _bin_ck_b)
+			gps_binary_fix();
+	}
 	return 1;
 }
 
-uint8_t gps_set_speed(const char* str) {
-	uint32_t speed = 0;
-	char* ptr = strchr(str, '.');
-	char* end = strchr(str, ',');
-	if(!end || end==str) return 0;
-	if(!ptr || end < ptr) //No decimal
-		ptr = end;
-	while(str < ptr) {
-		speed *= 10;
-		if(*str < '0' || *str > '9') return 0;
-		speed += (*str-'0');
-		str++;
+/*
+	Copy a complete binary packet into gps_fix
+	Every packet holds a whole fix, so each one completes an epoch
+*/
+void gps_binary_fix(void) {
+	const gps_binary_t* p = &_bin_packet;
+	uint8_t fix = (p->fix_type >= 2);
+	uint16_t part;
+	uint32_t value;
+
+	gps_fix.valid &= ~(VALID_LOC | VALID_ALT | VALID_SPD | VALID_DIR | VALID_MODE | VALID_DATE | VALID_TIME);
+	gps_fix.quality = fix?((p->fix_type >= 6)?2:1):0;
+	gps_fix.sats = p->sats;
+	gps_fix.hdop = p->hdop;
+	gps_fix.valid |= VALID_SATS | VALID_HDOP;
+	if(p->fix_type >= 1 && p->fix_type <= 7) {
+		gps_fix.mode = (p->fix_type >= 6)?p->fix_type-4:p->fix_type;
+		gps_fix.valid |= VALID_MODE;
 	}
-	speed *= 10;
-	// Use decimal point by making speed 10x the received value
-	if(ptr != end) {
-	    speed += (*(ptr+1)-'0');
+
+	if(fix) {
+		gps_fix.lat = p->lat;
+		gps_fix.lon = p->lon;
+		gps_fix.alt = p->alt/10;
+		gps_fix.speed = ((uint32_t)p->speed*7962) >> 12; // cm/s to 0.01 kt, 1.94384*4096 = 7962
+		gps_fix.course = p->course;
+		gps_fix.valid |= VALID_LOC | VALID_ALT | VALID_SPD | VALID_DIR;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			_msgs_elapsed = 0;
+		}
 	}
-	// Speed is given in knots, convert to mph by multiplying by 1.151
-	speed *= 1151;
-	speed /= 1000;
-
-	// Set decimal point
-	display_screen[4][15] = (char)(speed%10)+'0';
-	speed /= 10;
-
-	// Set integer part from least significant to most
-	display_screen[4][13] = (char)(speed%10)+'0';
-	speed /= 10;
-	display_screen[4][12] = (speed == 0)?' ':((char)(speed%10)+'0');
-	speed /= 10;
-	display_screen[4][11] = (speed == 0)?' ':((char)(speed%10)+'0');
-	speed /= 10;
-	display_screen[4][10] = (speed == 0)?' ':((char)(speed%10)+'0');
-	return (speed==0);
-}
-
-uint8_t gps_set_direction(const char* str) {
-	uint16_t direction = 0;
-	char* ptr = strchr(str, '.');
-	char* end = strchr(str, ',');
-	if(!end || end==str) return 0;
-	if(!ptr || end < ptr) //No decimal
-		ptr = end;
-	while(str < ptr) {
-		direction *= 10;
-		if(*str < '0' || *str > '9') return 0;
-		direction += (*str-'0');
+
+	// hhmmssmmm, avr-gcc does each 32 bit / and % pair with one __udivmodsi4 call
+	value = p->time;
+	gps_fix.centisecond = (uint16_t)(value % 1000)/10;
+	value /= 1000;
+	part = value % 10000;
+	gps_fix.hour = value/10000;
+	gps_fix.minute = part/100;
+	gps_fix.second = part%100;
+	if(gps_fix.hour < 24 && gps_fix.minute < 60 && gps_fix.second < 60)
+		gps_fix.valid |= VALID_TIME;
+
+	// ddmmyy, 0 until the module knows the date
+	value = p->date;
+	part = value % 10000;
+	gps_fix.day = value/10000;
+	gps_fix.month = part/100;
+	gps_fix.year = part%100;
+	if(gps_fix.day >= 1 && gps_fix.day <= 31 && gps_fix.month >= 1 && gps_fix.month <= 12)
+		gps_fix.valid |= VALID_DATE;
+
+	_epoch_ready = 1;
+}
+#endif
+
+/*
+	Add a parsed sentence to the epoch of its UTC time
+	The epoch is complete once every sentence in GPS_EPOCH_SENTENCES has arrived with the same time
+	An epoch missing a sentence is completed when the next one starts, and sentences without
+	a valid time can't be grouped so each one completes an epoch on its own
+*/
+void gps_epoch_add(uint8_t sentence) {
+	if(!(sentence & SENTENCES_WITH_TIME)) // Only sentences carrying a UTC time mark a fix
+		return;
+	if(!(gps_fix.valid & VALID_TIME)) {
+		_epoch_ready = 1;
+		return;
+	}
+	uint32_t time = ((uint32_t)gps_fix.hour << 24) | ((uint32_t)gps_fix.minute << 16) |
+					((uint16_t)gps_fix.second << 8) | gps_fix.centisecond;
+	if(time != _epoch_time) { // First sentence of a new fix
+		if(_epoch_seen != 0 && _epoch_seen != EPOCH_REPORTED)
+			_epoch_ready = 1; // Report the previous fix even though a sentence was lost
+		_epoch_time = time;
+		_epoch_seen = 0;
+	}
+	if(_epoch_seen == EPOCH_REPORTED)
+		return;
+	_epoch_seen |= sentence;
+	if((_epoch_seen & GPS_EPOCH_SENTENCES) == GPS_EPOCH_SENTENCES) {
+		_epoch_ready = 1;
+		_epoch_seen = EPOCH_REPORTED;
+	}
+}
+
+/*
+	Parse a decimal number with an optional sign into fixed point with 'decimals' digits after the point
+	Extra decimal digits are truncated, missing ones are padded with zeros
+	Return 0 if the field is empty or contains anything other than digits and one '.'
+*/
+uint8_t gps_parse_fixed(const char* str, uint8_t len, uint8_t decimals, int32_t* value) {
+	int32_t result = 0;
+	uint8_t negative = 0;
+	uint8_t point = 0; // Set once the decimal point has been passed
+	if(len && *str == '-') {
+		negative = 1;
 		str++;
+		len--;
+	}
+	if(len == 0)
+		return 0;
+	while(len--) {
+		char ch = *str++;
+		if(ch == '.' && !point) {
+			point = 1;
+		} else if(ch < '0' || ch > '9') {
+			return 0;
+		} else if(!point || decimals) {
+			result = result*10 + (ch-'0');
+			if(point) decimals--;
+		}
+	}
+	while(decimals--) // Pad missing decimal digits
+		result *= 10;
+	*value = negative?-result:result;
+	return 1;
+}
+
+/*
+	Convert two ASCII digits to a number
+	Return 0xFF if either character is not a digit
+*/
+uint8_t gps_parse_2digits(const char* str) {
+	if(str[0] < '0' || str[0] > '9' || str[1] < '0' || str[1] > '9')
+		return 0xFF;
+	return (str[0]-'0')*10 + (str[1]-'0');
+}
+
+/*
+	Parse a [d]ddmm.mmmm coordinate with 'digits' degree digits into 1e-7 degrees
+	Return 0 if the field is malformed
+*/
+uint8_t gps_parse_coord(const char* str, uint8_t len, uint8_t digits, int32_t* coord) {
+	if(len < digits+2)
+		return 0;
+	int32_t degrees = 0;
+	uint8_t i;
+	for(i = 0; i < digits; i++) {
+		if(str[i] < '0' || str[i] > '9')
+			return 0;
+		degrees = degrees*10 + (str[i]-'0');
 	}
-	
+	// Minutes with 5 decimal places, converted with 1e-5 minute = 1e-7 degree * 5/3
+	int32_t minutes;
+	if(!gps_parse_fixed(str+digits, len-digits, 5, &minutes) || minutes < 0 || minutes >= 6000000)
+		return 0;
+	*coord = degrees*10000000 + (minutes*5+1)/3;
+	return 1;
+}
+
+uint8_t gps_set_time(const char* str, uint8_t len) {
+	uint8_t hour = gps_parse_2digits(str);
+	uint8_t minute = gps_parse_2digits(str+2);
+	uint8_t second = gps_parse_2digits(str+4);
+	if(hour > 23 || minute > 59 || second > 60) // 60 allows for a leap second
+		return 0;
+	uint8_t centisecond = 0;
+	if(len > 7 && str[7] >= '0' && str[7] <= '9') {
+		centisecond = (str[7]-'0')*10;
+		if(len > 8 && str[8] >= '0' && str[8] <= '9')
+			centisecond += str[8]-'0';
+	}
+	PARSED_FIX.hour = hour;
+	PARSED_FIX.minute = minute;
+	PARSED_FIX.second = second;
+	PARSED_FIX.centisecond = centisecond;
+	return 1;
+}
+
+/*
+	Store the latitude in _coord with the sign from its hemisphere field
+*/
+uint8_t gps_set_lat(const char* str, uint8_t len) {
+	if(len != 1 || (*str != 'N' && *str != 'S'))
+		return 0;
+	PARSED_FIX.lat = (*str == 'S')?-_coord:_coord;
+	return 1;
+}
+
+/*
+	Store the longitude in _coord with the sign from its hemisphere field
+*/
+uint8_t gps_set_long(const char* str, uint8_t len) {
+	if(len != 1 || (*str != 'E' && *str != 'W'))
+		return 0;
+	PARSED_FIX.lon = (*str == 'W')?-_coord:_coord;
+	return 1;
+}
+
+uint8_t gps_set_alt(const char* str, uint8_t len) {
+	return gps_parse_fixed(str, len, 1, &PARSED_FIX.alt);
+}
+
+uint8_t gps_set_speed(const char* str, uint8_t len) {
+	int32_t speed;
+	if(!gps_parse_fixed(str, len, 2, &speed) || speed < 0 || speed > 0xFFFF)
+		return 0;
+	PARSED_FIX.speed = speed;
+	return 1;
+}
+
+uint8_t gps_set_direction(const char* str, uint8_t len) {
+	int32_t course;
+	if(!gps_parse_fixed(str, len, 2, &course) || course < 0 || course >= 36000)
+		return 0;
+	PARSED_FIX.course = course;
+	return 1;
+}
+
+uint8_t gps_set_date(const char* str) {
+	uint8_t day = gps_parse_2digits(str);
+	uint8_t month = gps_parse_2digits(str+2);
+	uint8_t year = gps_parse_2digits(str+4);
+	if(day == 0 || day > 31 || month == 0 || month > 12 || year > 99)
+		return 0;
+	PARSED_FIX.day = day;
+	PARSED_FIX.month = month;
+	PARSED_FIX.year = year;
+	return 1;
+}
+
+uint8_t gps_set_count(const char* str, uint8_t len, uint8_t* count) {
+	int32_t value;
+	if(!gps_parse_fixed(str, len, 0, &value) || value < 0 || value > 99)
+		return 0;
+	*count = value;
+	return 1;
+}
+
+uint8_t gps_set_dop(const char* str, uint8_t len, uint16_t* dop) {
+	int32_t value;
+	if(!gps_parse_fixed(str, len, 2, &value) || value < 0 || value > 0xFFFF)
+		return 0;
+	*dop = value;
+	return 1;
+}
+
+/*
+	Format the date slot as "MM/DD/YY"
+*/
+uint8_t gps_format_date(char* str) {
+	if(!(gps_fix.valid & VALID_DATE))
+		return 0;
+	fmt_2digits(str+0, gps_fix.month);
+	str[2] = '/';
+	fmt_2digits(str+3, gps_fix.day);
+	str[5] = '/';
+	fmt_2digits(str+6, gps_fix.year);
+	return 1;
+}
+
+/*
+	Format the time slot as "HH:MM"
+*/
+uint8_t gps_format_time(char* str) {
+	if(!(gps_fix.valid & VALID_TIME))
+		return 0;
+	fmt_2digits(str+0, gps_fix.hour);
+	str[2] = ':';
+	fmt_2digits(str+3, gps_fix.minute);
+	return 1;
+}
+
+/*
+	Write a coordinate in 1e-7 degrees with 'digits' degree digits as "ddd* mm.mmmm' h"
+	Leading zeros of the degrees and minutes are replaced with spaces
+*/
+void gps_format_coord(char* str, int32_t coord, uint8_t digits, char pos, char neg) {
+	char* min = str+digits+2;
+	min[9] = (coord < 0)?neg:pos;
+	if(coord < 0)
+		coord = -coord;
+	uint16_t degrees = coord/10000000;
+	// 1e-7 degree = 6e-6 minute, rounded to 4 decimal places
+	uint32_t minutes = ((coord%10000000)*6+50)/100;
+	if(minutes > 599999)
+		minutes = 599999;
+
+	fmt_fixed(min, 7, minutes, 4);
+	min[7] = '\'';
+	min[8] = ' ';
+
+	str[digits] = '\xDF';
+	str[digits+1] = ' ';
+	fmt_uint(str, digits, degrees, ' ');
+}
+
+/*
+	Format the latitude slot
+*/
+uint8_t gps_format_lat(char* str) {
+	if(!(gps_fix.valid & VALID_LOC))
+		return 0;
+	gps_format_coord(str, gps_fix.lat, 2, 'N', 'S');
+	return 1;
+}
+
+/*
+	Format the longitude slot
+*/
+uint8_t gps_format_long(char* str) {
+	if(!(gps_fix.valid & VALID_LOC))
+		return 0;
+	gps_format_coord(str, gps_fix.lon, 3, 'E', 'W');
+	return 1;
+}
+
+/*
+	Format the altitude slot, 0.1 m right-aligned as "aaaa.a"
+*/
+uint8_t gps_format_alt(char* str) {
+	if(!(gps_fix.valid & VALID_ALT))
+		return 0;
+	fmt_fixed(str, 6, gps_fix.alt, 1);
+	return 1;
+}
+
+/*
+	Format the speed slot, 0.01 knots as mph with one decimal place
+*/
+uint8_t gps_format_speed(char* str) {
+	if(!(gps_fix.valid & VALID_SPD))
+		return 0;
+	// Speed is given in knots, convert to mph by multiplying by 1.151
+	uint32_t mph = (uint32_t)(gps_fix.speed/10)*1151/1000;
+	fmt_fixed(str, 6, mph, 1);
+	return 1;
+}
+
+/*
+	Format the direction slot, the compass direction of the course
+*/
+uint8_t gps_format_direction(char* str) {
+	if(!(gps_fix.valid & VALID_DIR))
+		return 0;
+	uint16_t direction = gps_fix.course/100;
+
 	// Determine N/S
 	if(direction <= 68 || direction >= 292) { // North
-		display_screen[5][14] = 'N';
+		str[0] = 'N';
 	} else if(direction >= 112 && direction <= 248) { // South
-		display_screen[5][14] = 'S';
+		str[0] = 'S';
 	} else { // Neither N/S
-		display_screen[5][14] = ' ';
+		str[0] = ' ';
 	}
 
 	// Determine E/W
 	if(direction >= 22 && direction <= 158) { // East
-		display_screen[5][15] = 'E';
+		str[1] = 'E';
 	} else if(direction >= 202 && direction <= 338) { // West
-		display_screen[5][15] = 'W';
+		str[1] = 'W';
 	} else { // Neither E/W
-		display_screen[5][15] = ' ';
+		str[1] = ' ';
 	}
 	return 1;
 }
 
-uint8_t gps_set_date(const char* str) {
-	display_screen[0][0] = str[2];	// First digit of month
-	display_screen[0][1] = str[3];	// Second digit of month
-	display_screen[0][3] = str[0];	// First digit of day
-	display_screen[0][4] = str[1];	// Second digit of day
-	display_screen[0][6] = str[4];	// First digit of year
-	display_screen[0][7] = str[5];	// Second digit of year
+/*
+	Format one row of the big speed slots, whole mph as up to 3 big digits
+	Leading zeros are left blank
+*/
+uint8_t gps_format_big_speed(char* str, uint8_t row) {
+	if(!(gps_fix.valid & VALID_SPD))
+		return 0;
+	uint16_t mph = ((uint32_t)gps_fix.speed*1151+50000)/100000;
+	if(mph > 999)
+		mph = 999;
+	lcd_bigdigit(str+0, (mph < 100)?0xFF:mph/100, row);
+	str[3] = ' ';
+	lcd_bigdigit(str+4, (mph < 10)?0xFF:(mph/10)%10, row);
+	str[7] = ' ';
+	lcd_bigdigit(str+8, mph%10, row);
 	return 1;
 }
 
+uint8_t gps_format_big_speed_top(char* str) {
+	return gps_format_big_speed(str, 0);
+}
+
+uint8_t gps_format_big_speed_bottom(char* str) {
+	return gps_format_big_speed(str, 1);
+}
+
 /*
-	Transmit string to GPS module
+	Check if no valid location has been found in GPS_TIMEOUT_MSGS sentences
 */
-void gps_stringout(const char* str) {
-	while(*str != '\0') {
-		gps_charout(*str);
-		str++;
+uint8_t gps_timed_out(void) {
+	uint16_t elapsed;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		elapsed = _msgs_elapsed;
+	}
+	return (elapsed >= GPS_TIMEOUT_MSGS);
+}
+
+/*
+	Start sending a PMTK command from flash in the background, the transmitter must be idle
+*/
+void gps_command_start(const char* str) {
+	_tx_state = TX_START;
+	_tx_cmd = str;
+	UCSR0B |= (1 << UDRIE0);
+}
+
+/*
+	Returns the next character of _tx_cmd, setting _tx_cmd to NULL after the last one
+*/
+char gps_tx_next(void) {
+	char ch;
+	switch(_tx_state++) {
+	case TX_START:
+		_tx_parity = 0;
+		return '$';
+	case TX_BODY:
+		ch = pgm_read_byte(_tx_cmd);
+		if(ch == '\0')
+			return '*';
+		_tx_cmd++;
+		_tx_parity ^= ch;
+		_tx_state = TX_BODY;
+		return ch;
+	case TX_CS1:
+		return pgm_read_byte(&_hex_digits[_tx_parity >> 4]);
+	case TX_CS2:
+		return pgm_read_byte(&_hex_digits[_tx_parity & 0x0F]);
+	case TX_CR:
+		return '\r';
 	}
+	_tx_cmd = NULL;
+	return '\n';
+}
+
+/*
+	Clear the transmit complete flag once the last character of a command is in UDR0
+	A character still in the shift register can't set it any more, so it is only set once the
+	whole command has left. Only U2X0 is kept, the other flags must be written as 0
+*/
+void gps_tx_end(void) {
+	UCSR0A = (UCSR0A & (1 << U2X0)) | (1 << TXC0);
 }
 
 /*
@@ -450,58 +1415,117 @@ void gps_charout(char ch) {
 }
 
 /*
-	Check for valid checksum
-	Return 0 if invalid, 1 if valid
+	Interrupt for sending the next character of a command started by gps_command_start()
 */
-uint8_t gps_checksum_check(const char* str, uint8_t length) {
-    if(length < 10 || str[length-3] != '*')
-        return 0;
-    int8_t cs1 = hex_to_int(str[length-2]);
-    int8_t cs2 = hex_to_int(str[length-1]);
-    if(cs1 < 0 || cs2 < 0)
-        return 0;
-    uint8_t checksum = (cs1<<4)|cs2;
-    uint8_t i = 0;
-    uint8_t parity = 0;
-    while(i < length-3) {
-        parity ^= str[i++];
-    }
-    return (checksum == parity);
+ISR(USART_UDRE_vect) {
+	UDR0 = gps_tx_next();
+	if(_tx_cmd == NULL) {
+		gps_tx_end();
+		UCSR0B &= ~(1 << UDRIE0);
+	}
 }
 
+#if GPS_STREAM
 /*
 	Interrupt for receiving a character
+	Characters are only queued here, gps_update() parses them
 */
 ISR(USART_RX_vect) {
 	char ch = UDR0;
-	if(ch == '\n') {
-		ch = '\0';
+	uint8_t head = _fifo_head;
+	uint8_t next = FIFO_NEXT(head);
+	if(next == _fifo_tail) { // FIFO is full, the checksum will reject the damaged sentence
+		_fifo_dropped++;
+		return;
 	}
+	_fifo[head] = ch;
+	_fifo_head = next;
+
+	uint8_t waiting = (next-_fifo_tail) & (GPS_FIFO_SIZE-1);
+	if(waiting > _fifo_high_water)
+		_fifo_high_water = waiting;
+}
+#else
+/*
+	Interrupt for receiving a character
+	Field boundaries and the checksum are found here as each character arrives,
+	so a completed sentence is handed over already indexed and verified
+*/
+ISR(USART_RX_vect) {
+	char ch = UDR0;
 
 	if(ch == '$') {
 		_start_flag = 1;
 		_buff_idx = 0;
-		if(!(_valid_data & VALID_LOC)) {
-			_msgs_elapsed++;
-			if(_msgs_elapsed > 250) // Prevent overflow
-				_msgs_elapsed = 200;
+		_parity = 0;
+		_checksum = 0;
+		_cs_state = CS_NONE;
+		_ring[_ring_head].count = 1;
+		_ring[_ring_head].field[0] = 0;
+		if(!(gps_fix.valid & VALID_LOC)) {
+			if(_msgs_elapsed < GPS_TIMEOUT_MSGS) // Prevent overflow
+				_msgs_elapsed++;
 		}
 	} else if(_start_flag) {
-		_buff_line[_buff_idx++] = ch;
-		if(ch == '\0') { // End of transmitted line
+		uint8_t head = _ring_head;
+		gps_sentence_t* line = &_ring[head];
+		uint8_t idx = _buff_idx;
+		if(ch == '\r') {
+			return; // Ignore carriage return before the line feed
+		} else if(ch == '\n') { // End of transmitted line
 			_start_flag = 0;
-			_new_msg = 1;
-			_line_len = _buff_idx-1;
-
-			// Swap _buff_line and _last_line pointers
-			char* temp = (char*)_buff_line;
-			_buff_line = _last_line;
-			_last_line = temp;
-		} else if(_buff_idx >= MAX_SENTENCE_LEN) { // Discard line if longer than expected
+			line->text[idx] = '\0';
+			line->len = idx;
+			// Checksum is valid if exactly 2 hex digits followed '*' and they match
+			if(_cs_state != 2 || _checksum != _parity)
+				line->count = 0;
+
+			uint8_t next = RING_NEXT(head);
+			if(next == _ring_tail) { // Ring is full, drop the newest sentence
+				_ring_dropped++;
+				return;
+			}
+			MEMORY_BARRIER();
+			_ring_head = next; // Publish the sentence to gps_acquire()
+
+			uint8_t waiting = gps_check();
+			if(waiting > _ring_high_water)
+				_ring_high_water = waiting;
+			return;
+		} else if(idx >= MAX_SENTENCE_LEN-1) { // Discard line if longer than expected
 			_start_flag = 0;
+			return;
+		}
+
+		line->text[idx] = ch;
+		_buff_idx = idx+1;
+		if(_cs_state == CS_NONE) {
+			if(ch == '*') {
+				line->field[line->count] = idx+1; // Marks the end of the last field
+				_cs_state = 0;
+			} else {
+				_parity ^= ch;
+				if(ch == ',') { // Record the start of the next field
+					if(line->count < GPS_MAX_FIELDS)
+						line->field[line->count++] = idx+1;
+					else
+						_cs_state = CS_ERROR; // More fields than any handled sentence
+				}
+			}
+		} else if(_cs_state < 2) {
+			int8_t digit = hex_to_int(ch);
+			if(digit < 0) {
+				_cs_state = CS_ERROR;
+			} else {
+				_checksum = (_checksum << 4) | digit;
+				_cs_state++;
+			}
+		} else {
+			_cs_state = CS_ERROR;
 		}
 	}
 }
+#endif
 
 /*
 	Convert a hex digit 0-F to decimal 0-15
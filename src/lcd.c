@@ -1,51 +1,188 @@
+#include <string.h>
+
 #include "lcd.h"
 
 // Private functions for lcd.c
 void lcd_writenibble(uint8_t bits);
 void lcd_writecommand(uint8_t cmd);
 void lcd_writedata(uint8_t dat);
+void lcd_ports(void);
+void lcd_setup(void);
 uint8_t row_offset(uint8_t row);
+uint8_t lcd_cell(uint8_t row, uint8_t col);
+#if LCD_BUSY_FLAG
+uint8_t lcd_busy(void);
+void lcd_wait(void);
+#endif
+#if LCD_ASYNC
+void lcd_queue(uint8_t op, uint8_t value);
+void lcd_sendbyte(uint8_t rs, uint8_t value);
+#endif
+
+/*
+    Cells are indexed in DDRAM address order: row 0, row 2, row 1, row 3
+    The HD44780 address counter runs through all 80 cells in this order and wraps back to 0,
+    so a cell index + 1 is always where the LCD writes next
+*/
+char _ddram[LCD_CELLS];     // Shadow of what the LCD is showing
+char _frame[LCD_CELLS];     // Next frame, sent by lcd_frame_commit()
+uint8_t _cursor = 0;        // Cell of the LCD address counter
+uint8_t _init_step = 0;     // Next step of lcd_init_step(), 6 once the LCD is ready
+const uint8_t *_cgram[LCD_GLYPHS];       // Glyph in flash loaded into each CGRAM slot, NULL if unknown
+
+// Backlight animation state, shared with TIMER2_OVF_vect
+uint16_t _fade_level[3];    // Current R, G, B perceptual levels in 8.8 fixed point
+int16_t _fade_step[3];      // Added to _fade_level every tick of a fade
+uint8_t _fade_target[3];    // Levels at the end of the fade
+uint16_t _fade_ticks = 0;   // Ticks left in the fade
+uint8_t _brightness = 255;  // Ambient scaling of all channels
+uint16_t _pulse_phase = 0;  // Triangle wave phase, one period per 65536
+uint16_t _pulse_step = 0;   // Added to _pulse_phase every tick, 0 when not pulsing
+
+// Perceptual level to PWM duty cycle, gamma 2.2
+const uint8_t _gamma[256] PROGMEM = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+};
+
+// _cursor value while the address counter points into CGRAM
+#define CURSOR_CGRAM 0xFF
+
+/*
+    Glyphs for 3x2 character digits, the corners are rounded
+*/
+const lcd_glyph_t lcd_bigdigit_glyphs[] PROGMEM = {
+    {0x07, 0x0F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F},  // 0: Upper left corner
+    {0x1F, 0x1F, 0x1F, 0x00, 0x00, 0x00, 0x00, 0x00},  // 1: Upper bar
+    {0x1C, 0x1E, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F},  // 2: Upper right corner
+    {0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x0F, 0x07},  // 3: Lower left corner
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x1F, 0x1F},  // 4: Lower bar
+    {0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1E, 0x1C},  // 5: Lower right corner
+    {0x1F, 0x1F, 0x1F, 0x00, 0x00, 0x00, 0x1F, 0x1F}   // 6: Upper and lower bar
+};
+
+// Characters of each big digit, top row then bottom row
+#define G(i) LCD_GLYPH(i)
+#define B '\xFF' // Full block in the LCD character ROM
+const char _bigdigits[10][6] PROGMEM = {
+    {G(0), G(1), G(2), G(3), G(4), G(5)},   // 0
+    {G(1), G(2), ' ',  G(4), B,    G(4)},   // 1
+    {G(6), G(6), G(2), G(3), G(4), G(4)},   // 2
+    {G(6), G(6), G(2), G(4), G(4), G(5)},   // 3
+    {G(3), G(4), B,    ' ',  ' ',  B   },   // 4
+    {B,    G(6), G(6), G(4), G(4), G(5)},   // 5
+    {G(0), G(6), G(6), G(3), G(4), G(5)},   // 6
+    {G(1), G(1), G(2), ' ',  ' ',  B   },   // 7
+    {G(0), G(6), G(2), G(3), G(4), G(5)},   // 8
+    {G(0), G(6), G(2), G(4), G(4), G(5)}    // 9
+};
+#undef G
+#undef B
+const lcd_layout_t *_layout[LCD_ROWS];   // Layout whose text is in each row of the frame
+
+#if LCD_ASYNC
+// Queue of LCD_OP_* operations between the lcd_* calls (producer) and TIMER1_COMPA_vect (consumer)
+uint8_t _queue_op[LCD_QUEUE_SIZE];
+uint8_t _queue_value[LCD_QUEUE_SIZE];
+volatile uint8_t _queue_head = 0;
+volatile uint8_t _queue_tail = 0;
 
+// Values for _queue_op
+#define LCD_OP_COMMAND 0    // Write value to the command register
+#define LCD_OP_DATA    1    // Write value to the data register
+#define LCD_OP_WAIT    2    // Wait value ms before the next operation
+
+// Next index after i in the queue
+#define QUEUE_NEXT(i) (((i)+1) & (LCD_QUEUE_SIZE-1))
+#endif
 
 /***
     PUBLIC FUNCTIONS
 ***/
 
 /*
-    Initializes LCD
+    Initializes LCD, waiting through the power up sequence
 */
 void lcd_init(void) {
+    uint8_t wait;
+    while ((wait = lcd_init_step()) != 0)
+        while (wait--)
+            _delay_ms(1);
+}
+
+/*
+    Run the next step of the power up sequence without blocking
+    The backlight works from the first step, the text only once all steps are done
+    Returns the ms to wait before calling again, 0 once the LCD is ready
+*/
+uint8_t lcd_init_step(void) {
+    switch (_init_step) {
+    case 0:
+        lcd_ports();
+        // From HD44780 datasheet figure 24 on page 46
+        _init_step = 1;
+        return 50;              // Delay at least 40ms after 2.7V is reached
+    case 1:
+        PORTD &= ~LCD_RS_BIT;   // Set to command mode
+        lcd_writenibble(0x03);
+        _init_step = 2;
+        return 5;               // Delay at least 4ms
+    case 2:
+        lcd_writenibble(0x03);
+        _init_step = 3;
+        return 5;               // Delay at least 4ms
+    case 3:
+        lcd_writenibble(0x03);
+        _init_step = 4;
+        return 1;               // Delay at least 100us
+    case 4:
+        lcd_writenibble(0x03);
+#if LCD_BUSY_FLAG
+        _delay_us(50);          // Busy flag can't be read until the interface is set
+#endif
+        lcd_writenibble(0x02);  // Use 4-bit interface
+        _init_step = 5;
+        return 2;               // Delay at least 2ms
+    case 5:
+        lcd_setup();
+        _init_step = 6;
+        return 0;
+    }
+    return 0;
+}
+
+/*
+    Set up the pins, the timers and the backlight PWM
+*/
+void lcd_ports(void) {
     // Set output pins
     DDRB |= LCD_DATA_BITS;
     DDRD |= LCD_RS_BIT;
     DDRB |= LCD_EN_BIT;
+#if LCD_BUSY_FLAG
+    DDRC |= LCD_RW_BIT;
+    PORTC &= ~LCD_RW_BIT;   // Write mode except while reading the busy flag
+#endif
 
-    // From HD44780 datasheet figure 24 on page 46
-    _delay_ms(50);          // Delay at least 40ms after 2.7V is reached
-    PORTD &= ~LCD_RS_BIT;   // Set to command mode
-
-    lcd_writenibble(0x03);    
-    _delay_ms(5);           // Delay at least 4ms
-    lcd_writenibble(0x03);
-    _delay_ms(5);           // Delay at least 4ms
-    lcd_writenibble(0x03);
-    _delay_us(120);         // Delay at least 100us
-    lcd_writenibble(0x03);
-
-    lcd_writenibble(0x02);  // Use 4-bit interface
-    _delay_ms(2);           // Delay at least 2ms
-    
-    lcd_writecommand(0x28); // Function Set: 4-bit interface, 2 lines, 5x8 chars
-
-    uint8_t display_cmd = 0x08;
-
-    // Comment any of the 3 lines below to set the feature off
-    display_cmd |= 0x04; // Enable display on
-    display_cmd |= 0x02; // Enable cursor on
-    display_cmd |= 0x01; // Enable blinking on
-
-    lcd_writecommand(display_cmd); // Set up display mode
-    lcd_writecommand(0x06);        // Set Entry Mode
+#if LCD_ASYNC
+    // Timer1 free running at FREQ/8, the queue is drained by compare A
+    TCCR1A = 0;
+    TCCR1B = (1 << CS11);
+#endif
 
     // Setup RGB backlight
     DDRD |= (LCD_R_BIT | LCD_G_BIT | LCD_B_BIT);
@@ -64,7 +201,24 @@ void lcd_init(void) {
     TCCR0A |= (1 << COM0A1); // B
 
     lcd_set_rgb(LCD_COLOR_WHITE);   //Set white backlight
-    lcd_clear();                    // Clear the LCD screen
+}
+
+/*
+    Set the display mode once the 4-bit interface is up, and clear the screen
+*/
+void lcd_setup(void) {
+    lcd_writecommand(0x28); // Function Set: 4-bit interface, 2 lines, 5x8 chars
+
+    uint8_t display_cmd = 0x08;
+
+    // Comment any of the 3 lines below to set the feature off
+    display_cmd |= 0x04; // Enable display on
+    display_cmd |= 0x02; // Enable cursor on
+    display_cmd |= 0x01; // Enable blinking on
+
+    lcd_writecommand(display_cmd); // Set up display mode
+    lcd_writecommand(0x06);        // Set Entry Mode
+    lcd_clear();                   // Clear the LCD screen
 }
 
 /*
@@ -72,7 +226,17 @@ void lcd_init(void) {
 */
 void lcd_clear(void) {
     lcd_writecommand(0x01);
+#if LCD_BUSY_FLAG
+    // The busy flag is checked before the next byte
+#elif LCD_ASYNC
+    lcd_queue(LCD_OP_WAIT, 2);
+#else
     _delay_ms(2);           // Delay 2ms
+#endif
+    memset(_ddram, ' ', LCD_CELLS);
+    memset(_frame, ' ', LCD_CELLS);
+    memset(_layout, 0, sizeof(_layout));
+    _cursor = 0;
 }
 
 /*
@@ -80,7 +244,14 @@ void lcd_clear(void) {
 */
 void lcd_home(void) {
     lcd_writecommand(0x02);
+#if LCD_BUSY_FLAG
+    // The busy flag is checked before the next byte
+#elif LCD_ASYNC
+    lcd_queue(LCD_OP_WAIT, 2);
+#else
     _delay_ms(2);           // Delay 2ms
+#endif
+    _cursor = 0;
 }
 
 /*
@@ -91,6 +262,7 @@ void lcd_moveto(uint8_t row, uint8_t col) {
     uint8_t pos;
     pos = row_offset(row) | col;
     lcd_writecommand(0x80 | pos); // Send move command
+    _cursor = lcd_cell(row, col);
 }
 
 /*
@@ -117,14 +289,143 @@ void lcd_stringout(const char *str) {
 }
 
 /*
-    Set color of RGB backlight by changing the OCR values of the coresponding timers for each color
-    The OCR values change the PWM duty cycle by setting the signal high until it reaches the OCR value,
-    then keeping the signal low until reaching 255
+    Draw a layout from flash into the frame
+    The constant text is only copied when the rows last showed another layout, so dynamic
+    fields that are not formatted keep their previous characters
+*/
+void lcd_layout_draw(const lcd_layout_t *layout) {
+    lcd_layout_t l;
+    lcd_slot_t slot;
+    uint8_t i, j, redraw = 0;
+
+    memcpy_P(&l, layout, sizeof(l));
+    for (i = l.first_row; i < l.first_row + l.rows; i++)
+        if (_layout[i] != layout)
+            redraw = 1;
+    if (redraw) {
+        if (l.glyphs)
+            lcd_glyphs_load(l.glyphs, l.glyph_count);
+        for (i = 0; i < l.rows; i++) {
+            uint8_t cell = lcd_cell(l.first_row + i, 0);
+            for (j = 0; j < LCD_COLS; j++)
+                _frame[cell + j] = pgm_read_byte(l.text + i*LCD_COLS + j);
+            _layout[l.first_row + i] = layout;
+        }
+    }
+
+    for (i = 0; i < l.slot_count; i++) {
+        memcpy_P(&slot, &l.slots[i], sizeof(slot));
+        slot.format(&_frame[lcd_cell(slot.row, slot.col)]);
+    }
+}
+
+/*
+    Send the cells of the frame that differ from what the LCD is showing
+    A move command is only sent before a changed cell that doesn't follow the last one written
+    Each character or command costs about 100us on the bus, so a refresh that changes a few
+    digits takes well under 1ms instead of 2ms per full row
+    Returns the number of characters sent
+*/
+uint8_t lcd_frame_commit(void) {
+    uint8_t i, sent = 0;
+    for (i = 0; i < LCD_CELLS; i++) {
+        if (_frame[i] == _ddram[i])
+            continue;
+        if (i != _cursor) {
+            lcd_writecommand(0x80 | ((i < 2*LCD_COLS)?i:(0x40 + i - 2*LCD_COLS)));
+            _cursor = i;
+        }
+        lcd_writedata(_frame[i]);
+        sent++;
+    }
+    return sent;
+}
+
+/*
+    Load a glyph set into CGRAM slots 0 to count-1, skipping slots that already hold the glyph
+    The next direct lcd_charout()/lcd_stringout() needs an lcd_moveto() first
+    Returns the number of glyphs written
+*/
+uint8_t lcd_glyphs_load(const lcd_glyph_t *glyphs, uint8_t count) {
+    uint8_t i, j, next = LCD_GLYPHS, written = 0;
+    for (i = 0; i < count; i++) {
+        if (_cgram[i] == glyphs[i])
+            continue;
+        if (i != next) {    // CGRAM address counter isn't already there
+            lcd_writecommand(0x40 | (i << 3));
+            _cursor = CURSOR_CGRAM;
+        }
+        for (j = 0; j < 8; j++)
+            lcd_writedata(pgm_read_byte(&glyphs[i][j]));
+        _cgram[i] = glyphs[i];
+        next = i + 1;
+        written++;
+    }
+    return written;
+}
+
+/*
+    Write the 3 characters of 'row' (0 - top, 1 - bottom) of a big digit
+    lcd_bigdigit_glyphs must be loaded, a digit above 9 is written as spaces
+*/
+void lcd_bigdigit(char *str, uint8_t digit, uint8_t row) {
+    uint8_t i;
+    for (i = 0; i < 3; i++)
+        str[i] = (digit > 9) ? ' ' : pgm_read_byte(&_bigdigits[digit][row*3 + i]);
+}
+
+/*
+    Set color of RGB backlight at once, stopping any fade
 */
 void lcd_set_rgb(uint8_t r, uint8_t g, uint8_t b) {
-    OCR2B = r;
-    OCR0B = g;
-    OCR0A = b;
+    lcd_fade_rgb(r, g, b, 0);
+}
+
+/*
+    Fade the RGB backlight from its current color to a new one over 'ms' milliseconds
+    The fade runs in TIMER2_OVF_vect, this returns at once
+*/
+void lcd_fade_rgb(uint8_t r, uint8_t g, uint8_t b, uint16_t ms) {
+    uint16_t ticks = (uint32_t)ms*LCD_FADE_HZ/1000;
+    uint8_t target[3] = {r, g, b};
+    uint8_t i;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (i = 0; i < 3; i++) {
+            _fade_target[i] = target[i];
+            if (ticks)
+                _fade_step[i] = (((int32_t)target[i] << 8) - (int32_t)_fade_level[i]) / ticks;
+            else
+                _fade_level[i] = target[i] << 8;
+        }
+        _fade_ticks = ticks;
+        TIMSK2 |= (1 << TOIE2);
+    }
+}
+
+/*
+    Pulse the backlight brightness with a triangle wave of 'period_ms' milliseconds
+    0 stops pulsing. Changing the period keeps the phase, so the pulse rate can follow a
+    changing value without jumps
+*/
+void lcd_pulse(uint16_t period_ms) {
+    uint16_t step = period_ms ? (uint32_t)65536*1000/LCD_FADE_HZ/period_ms : 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        _pulse_step = step;
+        if (!step)
+            _pulse_phase = 0;
+        TIMSK2 |= (1 << TOIE2);
+    }
+}
+
+/*
+    Scale the whole backlight, e.g. from the ambient light level
+    'level': 0 - off, 255 - full brightness
+*/
+void lcd_set_brightness(uint8_t level) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        _brightness = level;
+        TIMSK2 |= (1 << TOIE2);
+    }
 }
 
 
@@ -139,18 +440,39 @@ void lcd_set_rgb(uint8_t r, uint8_t g, uint8_t b) {
     Write a byte to command register
 */
 void lcd_writecommand(uint8_t cmd) {
+#if LCD_ASYNC
+    lcd_queue(LCD_OP_COMMAND, cmd);
+#else
+#if LCD_BUSY_FLAG
+    lcd_wait();                 // Wait for the previous byte
+#endif
     PORTB &= ~LCD_RS_BIT;       // Set to command mode
     lcd_writenibble(cmd >> 4);  // Send upper 4 bits
     lcd_writenibble(cmd);       // Send lower 4 bits
+#endif
 }
 
 /*
     Write a byte to data register
 */
 void lcd_writedata(uint8_t dat) {
+#if LCD_ASYNC
+    lcd_queue(LCD_OP_DATA, dat);
+#else
+#if LCD_BUSY_FLAG
+    lcd_wait();                 // Wait for the previous byte
+#endif
     PORTB |= LCD_RS_BIT;        // Set to data mode
     lcd_writenibble(dat >> 4);  // Send upper 4 bits
     lcd_writenibble(dat);       // Send lower 4 bits
+#endif
+
+    // Keep the shadow and frame matching the LCD, so a commit doesn't undo direct writes
+    if (_cursor == CURSOR_CGRAM)
+        return;
+    _ddram[_cursor] = _frame[_cursor] = dat;
+    if (++_cursor == LCD_CELLS)
+        _cursor = 0;
 }
 
 /*
@@ -166,7 +488,11 @@ void lcd_writenibble(uint8_t lcdbits) {
     PORTD |= LCD_EN_BIT;
     _delay_us(1);
     PORTD &= ~LCD_EN_BIT;
+#if LCD_BUSY_FLAG
+    _delay_us(1);               // Enable cycle time, the busy flag covers the rest
+#else
     _delay_us(50);
+#endif
 }
 
 /*
@@ -184,4 +510,158 @@ uint8_t row_offset(uint8_t row) {
             return 0x54;
     }
     return 0x00;
+}
+
+/*
+    Returns the index of a cell in _ddram and _frame
+*/
+uint8_t lcd_cell(uint8_t row, uint8_t col) {
+    return ((row & 1) ? 2*LCD_COLS : 0) + ((row & 2) ? LCD_COLS : 0) + col;
+}
+
+#if LCD_BUSY_FLAG
+/*
+    Read the busy flag, the address counter nibbles are clocked out and ignored
+    Returns non-zero while the LCD is still executing the last byte
+*/
+uint8_t lcd_busy(void) {
+    uint8_t busy;
+    DDRB &= ~LCD_DATA_BITS;                 // Data pins to inputs
+    PORTB &= ~(LCD_DATA_BITS | LCD_RS_BIT); // No pull-ups, command register
+    PORTC |= LCD_RW_BIT;                    // Set to read mode
+
+    PORTD |= LCD_EN_BIT;
+    _delay_us(1);                           // Data is valid 360ns after enable rises
+    busy = PINB & (1 << (LCD_DATA_OFFSET+3)); // DB7
+    PORTD &= ~LCD_EN_BIT;
+    _delay_us(1);
+    PORTD |= LCD_EN_BIT;                    // Clock out the low nibble
+    _delay_us(1);
+    PORTD &= ~LCD_EN_BIT;
+
+    PORTC &= ~LCD_RW_BIT;                   // Back to write mode
+    DDRB |= LCD_DATA_BITS;
+    return busy;
+}
+
+/*
+    Wait until the LCD is ready for the next byte
+*/
+void lcd_wait(void) {
+    uint16_t polls = LCD_BUSY_POLLS;
+    while (lcd_busy() && --polls)
+        _delay_us(2);
+}
+#endif
+
+#if LCD_ASYNC
+/*
+    Add an operation to the queue, waiting for room if it is full
+    Starts the timer interrupt if the queue was idle
+*/
+void lcd_queue(uint8_t op, uint8_t value) {
+    uint8_t head = _queue_head;
+    uint8_t next = QUEUE_NEXT(head);
+    while (next == _queue_tail);    // Queue is full, wait for the interrupt to send some
+    _queue_op[head] = op;
+    _queue_value[head] = value;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        _queue_head = next;
+        if (!(TIMSK1 & (1 << OCIE1A))) {  // Idle, the last operation's wait is already over
+            TIFR1 = (1 << OCF1A);
+            OCR1A = TCNT1 + 4;
+            TIMSK1 |= (1 << OCIE1A);
+        }
+    }
+}
+
+/*
+    Send a byte to the LCD without waiting afterwards
+*/
+void lcd_sendbyte(uint8_t rs, uint8_t value) {
+    if (rs)
+        PORTB |= LCD_RS_BIT;
+    else
+        PORTB &= ~LCD_RS_BIT;
+    PORTB = (PORTB & ~LCD_DATA_BITS) | ((value >> 4) << LCD_DATA_OFFSET);
+    PORTD |= LCD_EN_BIT;
+    _delay_us(1);
+    PORTD &= ~LCD_EN_BIT;
+    _delay_us(1);
+    PORTB = (PORTB & ~LCD_DATA_BITS) | ((value & 0x0F) << LCD_DATA_OFFSET);
+    PORTD |= LCD_EN_BIT;
+    _delay_us(1);
+    PORTD &= ~LCD_EN_BIT;
+}
+
+/*
+    Timer interrupt that sends the next queued operation and schedules the one after it
+    Both nibbles of a byte only need the 1us enable cycle between them, the wait comes after
+*/
+ISR(TIMER1_COMPA_vect) {
+    uint8_t tail = _queue_tail;
+    if (tail == _queue_head) {  // Nothing left, lcd_queue() restarts the interrupt
+        TIMSK1 &= ~(1 << OCIE1A);
+        return;
+    }
+#if LCD_BUSY_FLAG
+    if (lcd_busy()) {           // Try again shortly, leaving the operation queued
+        OCR1A += LCD_US_TICKS(LCD_POLL_US);
+        return;
+    }
+#endif
+    uint8_t op = _queue_op[tail];
+    uint8_t value = _queue_value[tail];
+    _queue_tail = QUEUE_NEXT(tail);
+
+    if (op == LCD_OP_WAIT) {
+        OCR1A += value*LCD_US_TICKS(1000);
+    } else {
+        lcd_sendbyte(op == LCD_OP_DATA, value);
+#if LCD_BUSY_FLAG
+        OCR1A += LCD_US_TICKS(LCD_POLL_US);
+#else
+        OCR1A += LCD_US_TICKS(LCD_BYTE_US);
+#endif
+    }
+}
+#endif
+
+/*
+    Step the backlight animation once per PWM period and write the new duty cycles
+    The OCRs are double buffered in fast PWM mode, so updates never glitch
+*/
+ISR(TIMER2_OVF_vect) {
+    uint8_t i, active = 0;
+    uint8_t scale = _brightness;
+    uint8_t duty[3];
+
+    if (_fade_ticks) {
+        active = 1;
+        if (--_fade_ticks == 0) {
+            for (i = 0; i < 3; i++)
+                _fade_level[i] = _fade_target[i] << 8;
+        } else {
+            for (i = 0; i < 3; i++)
+                _fade_level[i] += _fade_step[i];
+        }
+    }
+
+    if (_pulse_step) {
+        active = 1;
+        _pulse_phase += _pulse_step;
+        uint8_t tri = _pulse_phase >> 7;           // 0-255 twice per period
+        if (_pulse_phase & 0x8000)
+            tri = ~tri;                             // Falling half of the triangle
+        scale = ((uint16_t)scale * (256 - ((uint16_t)tri*LCD_PULSE_DEPTH >> 8))) >> 8;
+    }
+
+    for (i = 0; i < 3; i++)
+        duty[i] = pgm_read_byte(&_gamma[((_fade_level[i] >> 8) * (scale + 1)) >> 8]);
+    OCR2B = duty[0];
+    OCR0B = duty[1];
+    OCR0A = duty[2];
+
+    if (!active)    // Steady, nothing to do until the next lcd_fade_rgb(), lcd_pulse() or lcd_set_brightness()
+        TIMSK2 &= ~(1 << TOIE2);
 }
\ No newline at end of file
@@ -2,66 +2,153 @@
     gps_update_test.c - Tests parsing and formatting ability of gps.c
 **/
 
-#include <stdio.h>
 #include "lcd.h"
 #include "gps.h"
 #include "adc.h"
+#include "fmt.h"
+#include "clock.h"
+#include "ttc.h"
 
-#define LINE_CHANGE_INTERVAL 40 //2 lines are read per second, so toggles information every 20 seconds
+#define LINE_CHANGE_INTERVAL (20*GPS_RATE_HZ) //LCD is updated once per fix, so toggles information every 20 seconds
 #define DARK_THRESH  400 // When lights are off, turn them on when below this threshold
 #define LIGHT_THRESH 600 // When lights are on, turn them off when above this threshold
 #define LED_BIT (1 << PD7)
 
 #define RED_THRESH      10*12 //Set Red warning at 10 feet
 #define YELLOW_THRESH   20*12 //Set Yellow warning at 20 feet
+#define TTC_RED_MS      1500  //Or when an object closing in will reach us within 1.5s
+#define TTC_YELLOW_MS   3000  //Or within 3s
 #define BUZZER_BIT (1 << PB1)
 
+#define FADE_MS        400 // Backlight fade between white and yellow
+#define RED_FADE_MS    100 // Backlight fade to red, kept short for the warning
+#define PULSE_MS_PER_IN 8  // Red pulse period per inch of distance, faster as an object gets closer
+#define PULSE_MIN_MS   120
+
+// Fixes between redraws of a field, so the LCD bus and formatting time go where they matter
+#define REFRESH_FIX    1                // Speed and direction, every fix while moving
+#define REFRESH_SECOND GPS_RATE_HZ      // Time, location and elapsed time
+#define REFRESH_SLOW   (2*GPS_RATE_HZ)  // Altitude
+#define REFRESH_PARKED (5*GPS_RATE_HZ)  // Every field once parked
+
+// Parked detection from the GPS speed, in 0.01 knots. Stationary GPS noise stays under 1 knot
+#define PARKED_SPEED 100              // Stopped below this
+#define MOVING_SPEED 200              // Moving again above this
+#define PARKED_FIXES (10*GPS_RATE_HZ) // Stopped this long counts as parked
+
+#define SPLASH_MS 3000 // Splash screen is shown for 3 seconds once the LCD is ready
+#define STEP_DONE 0xFFFFFFFF // gps_step_ms once the GPS is configured
+
+void boot_update(void);
 void light_update(void);
 void sonar_update(void);
-void lcd_update(void);
+void lcd_update(int8_t result);
+void parked_update(int8_t result);
+uint8_t refresh_due(uint8_t field, uint8_t fixes);
 void display_wait(void);
 void display_time(void);
 void display_elapsed(void);
 void display_location(void);
 void display_misc(void);
+void display_big_speed(void);
+uint8_t format_elapsed(char* str);
 
-char last_line[MAX_SENTENCE_LEN];
-uint8_t line_len = 0;
 uint8_t wait_displaying = 0;
 
-// Selects which of the 3 fields (altitude, speed, direction) to display
+// Selects what rows 1 and 2 show (location, elapsed time, big speed)
+// and which of the 3 fields (altitude, speed, direction) row 3 shows
 uint8_t line12_displayed = 0;
-uint8_t line12_counter = 0;
+uint16_t line12_counter = 0;
 uint8_t line3_displayed = 0;
-uint8_t line3_counter = 0;
+uint16_t line3_counter = 0;
+
+// Fixes left until each field is redrawn, 0 redraws on the next fix
+#define FIELD_TIME   0
+#define FIELD_LINE12 1
+#define FIELD_LINE3  2
+uint8_t refresh_left[3] = {0, 0, 0};
+// Moving refresh of each field row 3 can show, in line3_displayed order
+const uint8_t line3_refresh[] PROGMEM = {REFRESH_SLOW, REFRESH_FIX, REFRESH_FIX};
+
+uint8_t parked = 0;
+uint8_t stopped_fixes = 0; // Fixes in a row below PARKED_SPEED
 
 uint8_t lcd_color = 0; // 0 - white, 1 - yellow, 2 - red
+uint16_t pulse_ms = 0; // Red pulse period, 0 when not pulsing
+uint8_t brightness = 255; // Backlight brightness from the ambient light level
+
+// Start up runs from the main loop, so sonar and light monitoring work while the LCD and GPS start
+uint8_t boot_state = 0; // 0 - LCD powering up, 1 - splash showing, 2 - done
+uint32_t lcd_step_ms = 0; // clock_ms() when the next LCD step is due, or the splash ends
+uint32_t gps_step_ms = 0; // clock_ms() when the next GPS step is due, STEP_DONE once configured
+uint32_t lcd_ready_ms = 0; // clock_ms() when the LCD could show the splash, reported by lcd_bench
+uint32_t gps_ready_ms = 0; // clock_ms() when the GPS was configured, reported by lcd_bench
+
+// Layouts drawn by smart_bike.c, the GPS ones come from gps_layout()
+const char splash_text[] PROGMEM  = "EE459 Project       "
+                                    "Smart Bike Accessory";
+const char wait_text[] PROGMEM    = " Waiting for GPS... ";
+const char elapsed_text[] PROGMEM = "Elapsed Time:       "
+                                    "      --:--:--      ";
+const lcd_slot_t elapsed_slots[] PROGMEM = {
+    {2, 6, 8, format_elapsed}
+};
+const lcd_layout_t splash_layout[] PROGMEM = {{0, 2, splash_text, NULL, 0, NULL, 0}};
+const lcd_layout_t wait_layout[] PROGMEM = {{3, 1, wait_text, NULL, 0, NULL, 0}};
+const lcd_layout_t elapsed_layout[] PROGMEM = {{1, 2, elapsed_text, elapsed_slots, 1, NULL, 0}};
 
 void init(void) {
-    lcd_init();
-    gps_init();
+    clock_init();
     adc_init();
     PORTD &= ~LED_BIT;
     PORTB &= ~BUZZER_BIT;
-    sei(); // Enable interrupts
-}
-
-void splash(void) {
-    lcd_moveto(0,0);
-    lcd_stringout("EE459 Project");
-    lcd_moveto(1,0);
-    lcd_stringout("Smart Bike Accessory");
-    _delay_ms(3000); // Sleep 3 seconds
-    display_wait();
+    sei(); // Enable interrupts, the LCD and GPS are set up by boot_update()
 }
 
 void loop(void) {
+    boot_update();
     light_update();
     sonar_update();
-    if(gps_check()) {
-        lcd_update();
+    if(gps_update() && boot_state == 2) { // Redraw once all sentences of a fix have arrived
+        lcd_update(gps_status());
+    }
+    if(boot_state == 2) {
+        adc_wait(); // Sleep until the next sensor readings, ADC_SAMPLE_MS
+    } else {
+        _delay_ms(1); // Keep the init steps on time
+    }
+}
+
+void boot_update(void) {
+    uint32_t now = clock_ms();
+    uint8_t wait;
+
+    if(gps_step_ms != STEP_DONE && now >= gps_step_ms) {
+        wait = gps_init_step(); // Commands are sent by the UART interrupt
+        gps_step_ms = wait ? now + wait : STEP_DONE;
+        if(wait == 0) {
+            gps_ready_ms = now;
+        }
+    }
+
+    if(now < lcd_step_ms) {
+        return;
+    }
+    if(boot_state == 0) {
+        wait = lcd_init_step(); // The backlight is on from the first step
+        lcd_step_ms = now + wait;
+        if(wait == 0) {
+            lcd_layout_draw(splash_layout);
+            lcd_frame_commit();
+            lcd_step_ms = now + SPLASH_MS;
+            lcd_ready_ms = now;
+            boot_state = 1;
+        }
+    } else if(boot_state == 1) {
+        display_wait();
+        lcd_frame_commit();
+        boot_state = 2;
     }
-    _delay_ms(10);
 }
 
 void light_update() {
@@ -74,123 +161,180 @@ void light_update() {
         //Turn off lights when ambient light is bright enough
         PORTD &= ~LED_BIT;
     }
+
+    // Dim the backlight in the dark, only passing on changes larger than the sensor noise
+    uint8_t level = 64 + (light_lvl > 1023 ? 1023 : light_lvl)*3/16;
+    if(level > brightness+8 || level+8 < brightness) {
+        brightness = level;
+        lcd_set_brightness(brightness);
+    }
 }
 
 void sonar_update() {
     uint16_t distance = sonar_reading();
-    if(distance < RED_THRESH) {
+    uint16_t ttc;
+    uint16_t pulse = 0;
+    ttc_update();
+    ttc = ttc_ms();
+    if(distance < RED_THRESH || ttc < TTC_RED_MS) {
         if(lcd_color != 2) { // Only change if not already red
-            lcd_set_rgb(LCD_COLOR_RED);
+            lcd_fade_rgb(LCD_COLOR_RED, RED_FADE_MS);
             lcd_color = 2;
         }
+        pulse = distance*PULSE_MS_PER_IN;
+        if(ttc/4 < pulse) pulse = ttc/4; // Or faster when closing in fast
+        if(pulse < PULSE_MIN_MS) pulse = PULSE_MIN_MS;
         PORTB |= BUZZER_BIT;
-    } else if(distance < YELLOW_THRESH) {
+    } else if(distance < YELLOW_THRESH || ttc < TTC_YELLOW_MS) {
         if(lcd_color != 1) { // Only change if not already yellow
-            lcd_set_rgb(LCD_COLOR_YELLOW);
+            lcd_fade_rgb(LCD_COLOR_YELLOW, FADE_MS);
             lcd_color = 1;
         }
         PORTB &= ~BUZZER_BIT;
     } else {
         if(lcd_color != 0) { // Only change if not already white
-            lcd_set_rgb(LCD_COLOR_WHITE);
+            lcd_fade_rgb(LCD_COLOR_WHITE, FADE_MS);
             lcd_color = 0;
         }
         PORTB &= ~BUZZER_BIT;
     }
+    if(pulse != pulse_ms) { // The interrupt does the pulsing, only pass on changes
+        pulse_ms = pulse;
+        lcd_pulse(pulse_ms);
+    }
 }
 
-void lcd_update() {
-    line_len = gps_readline(last_line);
-    int8_t result = gps_parse(last_line, line_len);
+void lcd_update(int8_t result) {
+    parked_update(result);
+    line12_counter++;
     if(result == -1) {
-        if(line12_displayed == 0) { // If showing location switch to elapsed time
+        if(line12_displayed != 1) { // If showing location or speed switch to elapsed time
             line12_displayed = 1;
             line12_counter = 0;
+            refresh_left[FIELD_LINE12] = 0;
+        }
+        if(refresh_due(FIELD_LINE12, REFRESH_SECOND)) {
+            display_elapsed();
         }
-        display_elapsed();
         display_wait();
     } else {
-        if(result & VALID_LINE_0) {
+        if((result & VALID_LINE_0) && refresh_due(FIELD_TIME, REFRESH_SECOND)) {
             display_time();
         }
 
+        // Don't update LCD if error occured when parsing the last message
         if(line12_displayed == 0) {
-            if((!(result & VALID_LINE_1) || !(result & VALID_LINE_2))) { // Don't update LCD if error occured when parsing the last message
-                line12_counter++;
-            } else {
+            if((result & VALID_LINE_1) && (result & VALID_LINE_2) && refresh_due(FIELD_LINE12, REFRESH_SECOND)) {
                 display_location();
             }
+        } else if(line12_displayed == 1) {
+            if(refresh_due(FIELD_LINE12, REFRESH_SECOND)) {
+                display_elapsed();
+            }
         } else {
-            display_elapsed();
+            if((result & VALID_SPD) && refresh_due(FIELD_LINE12, REFRESH_FIX)) {
+                display_big_speed();
+            }
         }
-        if(line12_counter == LINE_CHANGE_INTERVAL) { // Toggle between whether location or elapsed time is displayed
+        if(line12_counter >= LINE_CHANGE_INTERVAL) { // Cycle between location, elapsed time and big speed
             line12_counter = 0;
-            line12_displayed ^= 1;
+            line12_displayed++;
+            if(line12_displayed == 3) line12_displayed = 0;
+            refresh_left[FIELD_LINE12] = 0;
         }
 
         if(result & VALID_LINE_3) {
-            if((line3_displayed == 0 && !(result & VALID_ALT)) ||
-                (line3_displayed == 1 && !(result & VALID_SPD))||
-                (line3_displayed == 2 && !(result & VALID_DIR))) {
-                line3_counter++;
-            } else {
+            line3_counter++;
+            if(((line3_displayed == 0 && (result & VALID_ALT)) ||
+                (line3_displayed == 1 && (result & VALID_SPD)) ||
+                (line3_displayed == 2 && (result & VALID_DIR))) &&
+                refresh_due(FIELD_LINE3, pgm_read_byte(&line3_refresh[line3_displayed]))) {
                 display_misc();
             }
-            if(line3_counter == LINE_CHANGE_INTERVAL) { // Toggle between whether altitude, speed, or direction are displayed
+            if(line3_counter >= LINE_CHANGE_INTERVAL) { // Toggle between whether altitude, speed, or direction are displayed
                 line3_counter=0;
                 line3_displayed++;
                 if(line3_displayed == 3) line3_displayed = 0;
+                refresh_left[FIELD_LINE3] = 0;
             }
         } else {
             display_wait();
         }
     }
+    lcd_frame_commit(); // Only send the characters that changed
+}
+
+/*
+    Parked once the speed has stayed under PARKED_SPEED for PARKED_FIXES, moving again above MOVING_SPEED
+*/
+void parked_update(int8_t result) {
+    if(result == -1 || !(gps_fix.valid & VALID_SPD)) {
+        return;
+    }
+    if(gps_fix.speed > MOVING_SPEED) {
+        stopped_fixes = 0;
+        if(parked) { // Catch up on everything at once
+            parked = 0;
+            refresh_left[FIELD_TIME] = refresh_left[FIELD_LINE12] = refresh_left[FIELD_LINE3] = 0;
+        }
+    } else if(gps_fix.speed < PARKED_SPEED) {
+        if(stopped_fixes < PARKED_FIXES) {
+            stopped_fixes++;
+        } else {
+            parked = 1;
+        }
+    }
+}
+
+/*
+    Count down a field's fixes to its next redraw
+    Returns 1 if it is due, and starts the next count of 'fixes' (REFRESH_PARKED while parked)
+*/
+uint8_t refresh_due(uint8_t field, uint8_t fixes) {
+    if(refresh_left[field] > 1) {
+        refresh_left[field]--;
+        return 0;
+    }
+    refresh_left[field] = parked ? REFRESH_PARKED : fixes;
+    return 1;
 }
 
 void display_wait(void) {
     if(!wait_displaying) {
         wait_displaying = 1;
-        lcd_moveto(3,0);
-        lcd_stringout(" Waiting for GPS... ");
+        lcd_layout_draw(wait_layout);
     }
 }
 
 void display_time(void) {
-    lcd_moveto(0,0);
-    lcd_stringout(display_screen[0]);
+    lcd_layout_draw(gps_layout(0));
 }
 
 void display_elapsed(void) {
-    if (line12_counter == 0) { //Only need to print when LCD switches from displaying location to elapsed
-        lcd_moveto(1,0);
-        lcd_stringout("Elapsed Time:       ");
-    }
-    lcd_moveto(2,0);
-    char timeStr[21];
-    snprintf(timeStr, 21, "      %02d:%02d:%02d      ",elapsedTime/3600,(elapsedTime/60)%60,elapsedTime%60);
-    lcd_stringout(timeStr);
-    line12_counter++;
+    lcd_layout_draw(elapsed_layout); // Labels are only copied when switching from the location
+}
+
+uint8_t format_elapsed(char* str) {
+    fmt_hms(str, elapsedTime);
+    return 1;
 }
 
 void display_location(void) {
-    lcd_moveto(1,0);
-    lcd_stringout(display_screen[1]);
-    lcd_moveto(2,0);
-    lcd_stringout(display_screen[2]);
-    line12_counter++;
+    lcd_layout_draw(gps_layout(1));
+}
+
+void display_big_speed(void) {
+    lcd_layout_draw(gps_layout(GPS_LINE_BIG_SPEED)); // Loads the big digit glyphs the first time
 }
 
 void display_misc(void) {
-    lcd_moveto(3,0);
-    lcd_stringout(display_screen[3+line3_displayed]);
+    lcd_layout_draw(gps_layout(3+line3_displayed));
     wait_displaying = 0;
-    line3_counter++;
 }
 
 int main(void)
 {
     init();
-    splash();
     while(1) {
         loop();
     }
@@ -0,0 +1,57 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "sonar.h"
+
+#if SONAR_PW
+volatile uint16_t _sonar_rise = 0;					// Timer1 count at the rising edge of the pulse
+volatile uint8_t _sonar_high = 0;					// Set once a rising edge was stamped
+volatile uint16_t _sonar_pw = 254*SONAR_PER_INCH;	// Last pulse in SONAR_PER_INCH units, nothing in range until the first
+
+/***
+    PUBLIC FUNCTIONS
+***/
+
+/*
+	Start timing the pulse width output, Timer1 must be running (clock_init())
+*/
+void sonar_init(void) {
+	DDRC &= ~SONAR_PW_BIT;		// Input without pull-up, the sensor drives it
+	PORTC &= ~SONAR_PW_BIT;
+	PCMSK1 |= SONAR_PW_BIT;		// PC3 is PCINT11
+	PCIFR = (1 << PCIF1);
+	PCICR |= (1 << PCIE1);
+}
+
+/*
+	Returns the last pulse in SONAR_PER_INCH units
+	Called from ADC_vect and from adc_init() with interrupts on, so PCINT1_vect can't split the read
+*/
+uint16_t sonar_pw(void) {
+	uint16_t pw;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		pw = _sonar_pw;
+	}
+	return pw;
+}
+
+/*
+	Pin change interrupt of the pulse width output: stamp the rising edge, measure at the falling one
+	The count is read first so the stamp is taken as close to the edge as possible
+*/
+ISR(PCINT1_vect) {
+	uint16_t now = TCNT1;
+	uint16_t width;
+
+	if(PINC & SONAR_PW_BIT) {
+		_sonar_rise = now;
+		_sonar_high = 1;
+	} else if(_sonar_high) {	// Not a pulse that was already under way at sonar_init()
+		_sonar_high = 0;
+		width = now - _sonar_rise;	// Wraps correctly, Timer1 overflows every 71ms
+		if(width >= SONAR_PW_MIN && width <= SONAR_PW_MAX)
+			_sonar_pw = SONAR_PW_SCALE(width);
+	}
+}
+#endif
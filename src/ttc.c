@@ -0,0 +1,80 @@
+#include "ttc.h"
+#include "adc.h"
+
+#define TTC_MASK (TTC_WINDOW-1)
+
+uint16_t _ttc_dist[TTC_WINDOW];		// Sonar distance of the last TTC_WINDOW scans, SONAR_PER_INCH units
+uint8_t _ttc_seq[TTC_WINDOW];		// adc_sequence() of each, as the timestamp
+uint8_t _ttc_head = 0;				// Slot of the next sample
+uint8_t _ttc_count = 0;				// Samples in the ring
+uint16_t _ttc = TTC_NONE;			// Last time to collision in ms
+
+/***
+    PUBLIC FUNCTIONS
+***/
+
+/*
+	Take in the sonar sample of a new ADC scan and update the estimate
+	Call at least once per ADC_SAMPLE_MS from the main loop, scans in between are skipped
+*/
+void ttc_update(void) {
+	uint8_t seq = adc_sequence();
+	uint8_t i = _ttc_head;
+	uint8_t oldest, mid, q;
+	uint16_t distance;
+	uint16_t dt1, dt2, dt;
+	int16_t closed, closed1, closed2;
+	uint32_t ttc;
+
+	if(_ttc_count && seq == _ttc_seq[(i-1) & TTC_MASK])
+		return; // No new scan
+	distance = adc_read(ADC_SONAR);	// Unscaled, for the sensor's full resolution
+	_ttc_dist[i] = distance;
+	_ttc_seq[i] = seq;
+	_ttc_head = (i+1) & TTC_MASK;
+	if(_ttc_count < TTC_WINDOW)
+		_ttc_count++;
+
+	if(_ttc_count < TTC_WINDOW) {
+		_ttc = TTC_NONE;
+		return;
+	}
+
+	// Every quarter of the window must close at least half its share, which rejects the flat
+	// part before a jump even with a count of noise in it
+	oldest = _ttc_head;
+	closed = _ttc_dist[oldest] - distance;
+	for(q = 0; q < TTC_WINDOW; q += TTC_WINDOW/4) {
+		i = (oldest + q) & TTC_MASK;
+		if((int16_t)(_ttc_dist[i] - _ttc_dist[(i + TTC_WINDOW/4 - (q == TTC_WINDOW*3/4)) & TTC_MASK])*8 <= closed) {
+			_ttc = TTC_NONE;
+			return;
+		}
+	}
+
+	// and both halves at speeds within a factor of 1.5, which rejects the fast start and slow tail of one
+	mid = (oldest + TTC_WINDOW/2) & TTC_MASK;
+	dt1 = (uint8_t)(_ttc_seq[mid] - _ttc_seq[oldest]) * ADC_SAMPLE_MS;
+	dt2 = (uint8_t)(seq - _ttc_seq[mid]) * ADC_SAMPLE_MS;
+	closed1 = _ttc_dist[oldest] - _ttc_dist[mid];
+	closed2 = _ttc_dist[mid] - distance;
+	dt = dt1 + dt2;
+
+	// Speeds are compared as closed*1000 against speed*dt, so only the estimate itself divides
+	if((int32_t)2*closed1*dt2 > (int32_t)3*closed2*dt1 ||
+		(int32_t)2*closed2*dt1 > (int32_t)3*closed1*dt2 ||
+		(int32_t)closed*1000 < (int32_t)TTC_MIN_SPEED*SONAR_PER_INCH*dt ||
+		(int32_t)closed*1000 > (int32_t)TTC_MAX_SPEED*SONAR_PER_INCH*dt) {
+		_ttc = TTC_NONE;
+		return;
+	}
+	ttc = (uint32_t)distance*dt/(uint16_t)closed;
+	_ttc = (ttc < TTC_NONE) ? ttc : TTC_NONE-1;
+}
+
+/*
+	Returns the time to collision in ms, TTC_NONE if nothing is approaching
+*/
+uint16_t ttc_ms(void) {
+	return _ttc;
+}
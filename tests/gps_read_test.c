@@ -5,8 +5,10 @@
 #include "lcd.h"
 #include "gps.h"
 
-char last_line[MAX_SENTENCE_LEN];
-uint8_t line_len = 0;
+#if GPS_STREAM
+#error "gps_read_test prints whole sentences from the ring, build it without GPS_STREAM"
+#endif
+
 uint8_t splash_on = 0;
 
 void init(void) {
@@ -23,19 +25,20 @@ void run_once(void) {
 
 void loop(void) {
 	if(gps_check()) {
-		line_len = gps_readline(last_line);
+		const gps_sentence_t* line = gps_acquire();
 		if(splash_on) {
 			lcd_clear();
 			splash_on = 0;
 		}
 		uint8_t i=0;
-		while(i < line_len && i < 80) {
+		while(i < line->len && i < 80) {
 			if(i==0) lcd_moveto(0,0);
 			if(i==20) lcd_moveto(1,0);
 			if(i==40) lcd_moveto(2,0);
 			if(i==60) lcd_moveto(3,0);
-			lcd_charout(last_line[i++]);
+			lcd_charout(line->text[i++]);
 		}
+		gps_release();
 	}
 }
 
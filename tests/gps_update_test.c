@@ -5,7 +5,7 @@
 #include "lcd.h"
 #include "gps.h"
 
-#define LINE_CHANGE_INTERVAL 40 //2 lines are read per second, so toggles information every 20 seconds
+#define LINE_CHANGE_INTERVAL (20*GPS_RATE_HZ) //LCD is updated once per fix, so toggles information every 20 seconds
 
 void display_wait(void);
 void update_info(void);
@@ -15,15 +15,19 @@ void display_elapsed(void);
 void display_location(void);
 void display_misc(void);
 
-char last_line[MAX_SENTENCE_LEN];
-uint8_t line_len = 0;
 uint8_t wait_displaying = 0;
 
+const char wait_text[] PROGMEM    = " Waiting for GPS... ";
+const char elapsed_text[] PROGMEM = "Elapsed Time:       "
+									"                    ";
+const lcd_layout_t wait_layout[] PROGMEM = {{3, 1, wait_text, NULL, 0, NULL, 0}};
+const lcd_layout_t elapsed_layout[] PROGMEM = {{1, 2, elapsed_text, NULL, 0, NULL, 0}};
+
 // Selects which of the 3 fields (altitude, speed, direction) to display
 uint8_t line12_displayed = 0;
-uint8_t line12_counter = 0;
+uint16_t line12_counter = 0;
 uint8_t line3_displayed = 0;
-uint8_t line3_counter = 0;
+uint16_t line3_counter = 0;
 
 void init(void) {
 	lcd_init();
@@ -33,6 +37,7 @@ void init(void) {
 
 void run_once(void) {
 	display_wait();
+	lcd_frame_commit();
 }
 
 void loop(void) {
@@ -40,9 +45,8 @@ void loop(void) {
 }
 
 void update_info(void) {
-	if(gps_check()) {
-		line_len = gps_readline(last_line);
-		int8_t result = gps_parse(last_line, line_len);
+	if(gps_update()) { // Redraw once all sentences of a fix have arrived
+		int8_t result = gps_status();
 		if(result == -1) {
 			if(line12_displayed == 0) { // If showing location switch to elapsed time
 				line12_displayed = 1;
@@ -86,41 +90,33 @@ void update_info(void) {
 				display_wait();
 			}
 		}
+		lcd_frame_commit(); // Only send the characters that changed
 	}
 }
 
 void display_wait(void) {
 	if(!wait_displaying) {
 		wait_displaying = 1;
-		lcd_moveto(3,0);
-		lcd_stringout(" Waiting for GPS... ");
+		lcd_layout_draw(wait_layout);
 	}
 }
 
 void display_time(void) {
-	lcd_moveto(0,0);
-	lcd_stringout(display_screen[0]);
+	lcd_layout_draw(gps_layout(0));
 }
 
 void display_elapsed(void) {
-	lcd_moveto(1,0);
-	lcd_stringout(display_screen[6]);
-	lcd_moveto(2,0);
-	lcd_stringout(display_screen[7]);
+	lcd_layout_draw(elapsed_layout);
 	line12_counter++;
 }
 
 void display_location(void) {
-	lcd_moveto(1,0);
-	lcd_stringout(display_screen[1]);
-	lcd_moveto(2,0);
-	lcd_stringout(display_screen[2]);
+	lcd_layout_draw(gps_layout(1));
 	line12_counter++;
 }
 
 void display_misc(void) {
-	lcd_moveto(3,0);
-	lcd_stringout(display_screen[3+line3_displayed]);
+	lcd_layout_draw(gps_layout(3+line3_displayed));
 	wait_displaying = 0;
 	line3_counter++;
 }
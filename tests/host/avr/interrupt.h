@@ -0,0 +1,12 @@
+#ifndef HOST_INTERRUPT_H
+#define HOST_INTERRUPT_H
+
+// Host stand-in for <avr/interrupt.h>, interrupt handlers become functions the host calls
+
+#include <avr/io.h>
+
+#define ISR(vector) void vector(void)
+#define sei()
+#define cli()
+
+#endif
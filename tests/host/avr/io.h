@@ -0,0 +1,71 @@
+#ifndef HOST_IO_H
+#define HOST_IO_H
+
+/*
+	Host stand-in for <avr/io.h>, registers are plain variables defined in hd44780.c
+	Only the registers and bits used by the sources in src/ are declared
+*/
+
+#include <stdint.h>
+
+extern volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+extern volatile uint8_t TCCR0A, TCCR0B, TCCR1A, TCCR1B, TCCR2A, TCCR2B;
+extern volatile uint8_t OCR0A, OCR0B, OCR2B, TIMSK1, TIMSK2, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B;
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+extern volatile uint16_t UBRR0;
+extern volatile uint8_t ADMUX, ADCSRA, EIMSK, EICRA;
+extern volatile uint16_t ADC;
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PC0 0
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+#define WGM00 0
+#define WGM01 1
+#define CS00 0
+#define CS01 1
+#define CS11 1
+#define CS22 2
+#define COM0A1 7
+#define COM0B1 5
+#define COM2B1 5
+#define TOIE2 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCF1A 1
+#define OCF1B 2
+
+#define U2X0 1
+#define UCSZ00 1
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define UDRE0 5
+#define TXC0 6
+#define RXCIE0 7
+
+#define INT0 0
+#define ISC00 0
+#define ISC01 1
+
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+#define ADSC 6
+#define ADEN 7
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef HOST_PGMSPACE_H
+#define HOST_PGMSPACE_H
+
+// Host stand-in for <avr/pgmspace.h>, flash and RAM share one address space on the host
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define memcpy_P memcpy
+#define strncmp_P strncmp
+
+#endif
@@ -0,0 +1,237 @@
+/***
+	hd44780.c - Emulates a 20x4 HD44780 on the port registers of the host build, see hd44780.h
+**/
+
+#include <string.h>
+
+#include "hd44780.h"
+#include "lcd.h"
+
+// Port layer, the registers the sources in src/ read and write
+volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+volatile uint8_t TCCR0A, TCCR0B, TCCR1A, TCCR1B, TCCR2A, TCCR2B;
+volatile uint8_t OCR0A, OCR0B, OCR2B, TIMSK1, TIMSK2, TIFR1;
+volatile uint16_t TCNT1, OCR1A, OCR1B;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+volatile uint16_t UBRR0;
+volatile uint8_t ADMUX, ADCSRA, EIMSK, EICRA;
+volatile uint16_t ADC;
+
+// Private functions for hd44780.c
+void hd44780_edge(void);
+void hd44780_execute(uint8_t rs, uint8_t value);
+char hd44780_glyph(uint8_t slot);
+
+double _hd_now = 0;				// Modeled time in us
+double _hd_busy_until = HD44780_POWER_US;
+double _hd_stats_start = 0;
+uint8_t _hd_four_bit = 0;			// Powers up in 8-bit mode
+uint8_t _hd_nibble = 0;			// Set once the high nibble of a 4-bit transfer has arrived
+uint8_t _hd_high = 0;				// High nibble waiting for the low one
+uint8_t _hd_ddram[128];
+uint8_t _hd_cgram[64];
+uint8_t _hd_ac = 0;				// Address counter
+uint8_t _hd_cg = 0;				// Set when _hd_ac points into CGRAM
+hd44780_stats_t _hd_stats;
+hd44780_transaction_t _hd_trace[HD44780_TRACE];
+unsigned _hd_trace_len = 0;
+
+// DDRAM address of the first cell of each row
+const uint8_t _hd_row_address[LCD_ROWS] = {0x00, 0x40, 0x14, 0x54};
+
+/***
+    PUBLIC FUNCTIONS
+***/
+
+/*
+	Sample the pins and advance the modeled time
+*/
+void hd44780_delay_us(double us) {
+	if (PORTD & LCD_EN_BIT)
+		hd44780_edge();
+	_hd_now += us;
+}
+
+/*
+	Start counting the statistics and the trace from now
+*/
+void hd44780_stats_reset(void) {
+	memset(&_hd_stats, 0, sizeof(_hd_stats));
+	_hd_stats_start = _hd_now;
+	_hd_trace_len = 0;
+}
+
+/*
+	Copy the statistics since hd44780_stats_reset()
+*/
+void hd44780_stats(hd44780_stats_t* stats) {
+	*stats = _hd_stats;
+	stats->bus_us = _hd_now - _hd_stats_start;
+}
+
+/*
+	Print every write since hd44780_stats_reset(), with its time from the reset
+*/
+void hd44780_trace(FILE* f) {
+	unsigned i;
+	for (i = 0; i < _hd_trace_len; i++) {
+		const hd44780_transaction_t* t = &_hd_trace[i];
+		if (t->rs)
+			fprintf(f, "%10.1fus  data 0x%02X '%c'\n", t->us, t->value,
+				(t->value >= 0x20 && t->value < 0x7F) ? t->value : '?');
+		else
+			fprintf(f, "%10.1fus  cmd  0x%02X\n", t->us, t->value);
+	}
+	if (_hd_stats.bytes > _hd_trace_len)
+		fprintf(f, "  ... %lu more\n", _hd_stats.bytes - _hd_trace_len);
+}
+
+/*
+	Render one row of the screen as LCD_COLS characters and a '\0'
+	CGRAM characters are drawn by shape: '#' full, '=' top and bottom bars, '"' top half,
+	'_' bottom half, ' ' empty
+*/
+void hd44780_row(uint8_t row, char* str) {
+	uint8_t col, ch;
+	for (col = 0; col < LCD_COLS; col++) {
+		ch = _hd_ddram[_hd_row_address[row] + col];
+		if (ch < 0x10)
+			str[col] = hd44780_glyph(ch & 0x07);
+		else if (ch == 0xFF)
+			str[col] = '#';				// Full block
+		else if (ch == 0xDF)
+			str[col] = 'o';				// Degree sign
+		else if (ch < 0x20 || ch >= 0x80)
+			str[col] = '?';
+		else
+			str[col] = ch;
+	}
+	str[LCD_COLS] = '\0';
+}
+
+/*
+	Print the screen with a border, like the layout comments in gps.c
+*/
+void hd44780_print(FILE* f) {
+	char str[LCD_COLS+1];
+	uint8_t row;
+	fprintf(f, " |====================|\n");
+	for (row = 0; row < LCD_ROWS; row++) {
+		hd44780_row(row, str);
+		fprintf(f, "%u|%s|%u\n", row, str, row);
+	}
+	fprintf(f, " |====================|\n");
+}
+
+/***
+    PRIVATE FUNCTIONS
+***/
+
+/*
+	Enable pulse: read out the busy flag or take in the nibble on the data pins
+*/
+void hd44780_edge(void) {
+	uint8_t nibble;
+	if (PORTC & LCD_RW_BIT) {
+		// Busy flag and address counter, high nibble first
+		uint8_t value = ((_hd_now < _hd_busy_until) ? 0x80 : 0x00) | (_hd_ac & 0x7F);
+		nibble = _hd_nibble ? (value & 0x0F) : (value >> 4);
+		PINB = (PINB & ~LCD_DATA_BITS) | (nibble << LCD_DATA_OFFSET);
+		if (_hd_nibble)
+			_hd_stats.reads++;
+		_hd_nibble = !_hd_nibble;
+		return;
+	}
+
+	nibble = (PORTB & LCD_DATA_BITS) >> LCD_DATA_OFFSET;
+	if (!_hd_four_bit) {
+		hd44780_execute(PORTB & LCD_RS_BIT, nibble << 4); // Low data pins aren't wired
+	} else if (!_hd_nibble) {
+		_hd_high = nibble;
+		_hd_nibble = 1;
+	} else {
+		_hd_nibble = 0;
+		hd44780_execute(PORTB & LCD_RS_BIT, (_hd_high << 4) | nibble);
+	}
+}
+
+/*
+	Carry out a command or data write
+*/
+void hd44780_execute(uint8_t rs, uint8_t value) {
+	double exec = HD44780_EXEC_US;
+
+	if (_hd_now < _hd_busy_until)
+		_hd_stats.early++;
+	if (_hd_trace_len < HD44780_TRACE) {
+		_hd_trace[_hd_trace_len].us = _hd_now - _hd_stats_start;
+		_hd_trace[_hd_trace_len].rs = rs != 0;
+		_hd_trace[_hd_trace_len].value = value;
+		_hd_trace_len++;
+	}
+	_hd_stats.bytes++;
+
+	if (rs) {
+		_hd_stats.data++;
+		exec = HD44780_DATA_US;
+		if (_hd_cg) {
+			_hd_cgram[_hd_ac & 0x3F] = value;
+			_hd_ac = (_hd_ac + 1) & 0x3F;
+		} else {
+			_hd_ddram[_hd_ac & 0x7F] = value;
+			// Two line mode: 0x00-0x27 is followed by 0x40-0x67, then back to 0x00
+			if (++_hd_ac == 0x28)
+				_hd_ac = 0x40;
+			else if (_hd_ac == 0x68)
+				_hd_ac = 0x00;
+		}
+	} else {
+		_hd_stats.commands++;
+		if (value & 0x80) {					// Set DDRAM address
+			_hd_ac = value & 0x7F;
+			_hd_cg = 0;
+		} else if (value & 0x40) {			// Set CGRAM address
+			_hd_ac = value & 0x3F;
+			_hd_cg = 1;
+		} else if (value & 0x20) {			// Function set
+			if (!(value & 0x10) && !_hd_four_bit) {
+				_hd_four_bit = 1;
+				_hd_nibble = 0;
+			}
+		} else if (value >= 0x01 && value <= 0x03) {	// Clear display, return home
+			if (value == 0x01)
+				memset(_hd_ddram, ' ', sizeof(_hd_ddram));
+			_hd_ac = 0;
+			_hd_cg = 0;
+			exec = HD44780_CLEAR_US;
+		}
+		// Display control, entry mode and shifts don't change what the screen shows here
+	}
+	_hd_busy_until = _hd_now + exec;
+}
+
+/*
+	Character for the shape of a CGRAM glyph, from the lit pixels in its top and bottom halves
+*/
+char hd44780_glyph(uint8_t slot) {
+	uint8_t i, top = 0, bottom = 0;
+	for (i = 0; i < 8; i++) {
+		uint8_t bits = _hd_cgram[slot*8 + i] & 0x1F;
+		uint8_t lit = 0;
+		while (bits) {
+			lit += bits & 1;
+			bits >>= 1;
+		}
+		if (i < 4)
+			top += lit;
+		else
+			bottom += lit;
+	}
+	if (top >= 10 && bottom >= 10)
+		return (_hd_cgram[slot*8 + 3] | _hd_cgram[slot*8 + 4]) & 0x1F ? '#' : '=';
+	if (top >= 10)
+		return '"';
+	if (bottom >= 10)
+		return '_';
+	return ' ';
+}
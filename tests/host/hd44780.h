@@ -0,0 +1,50 @@
+#ifndef HD44780_H
+#define HD44780_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+	HD44780 emulator for host builds of src/lcd.c
+	The port registers are plain variables, so the pins are sampled whenever the driver calls
+	_delay_us() or _delay_ms(). Every enable pulse in lcd.c holds the pin high through exactly
+	one delay, so each delay that starts with enable high is taken as one pulse, with the data
+	and RS/RW lines that go with it.
+	Time only advances through those delays, CPU time between them is not modeled.
+
+	Modeled execution times at the nominal 270kHz oscillator:
+	  Clear display, return home    1520us
+	  Other commands                37us
+	  Data write                    41us (37us plus the address counter update)
+	Bytes written before the previous one finished are counted as early, a real LCD drops them
+*/
+
+#define HD44780_CLEAR_US 1520.0
+#define HD44780_EXEC_US  37.0
+#define HD44780_DATA_US  41.0
+#define HD44780_POWER_US 40000.0	// Not ready until 40ms after power up
+#define HD44780_TRACE    1024		// Transactions kept by the trace
+
+typedef struct {
+	unsigned long bytes;		// Bytes written to the command or data register
+	unsigned long commands;
+	unsigned long data;
+	unsigned long reads;		// Busy flag and address counter reads
+	unsigned long early;		// Bytes written while the LCD was still busy
+	double bus_us;				// Modeled time since hd44780_stats_reset()
+} hd44780_stats_t;
+
+typedef struct {
+	double us;					// Modeled time of the write
+	uint8_t rs;					// 0 - command, 1 - data
+	uint8_t value;
+} hd44780_transaction_t;
+
+void hd44780_delay_us(double us);
+void hd44780_stats_reset(void);
+void hd44780_stats(hd44780_stats_t* stats);
+void hd44780_trace(FILE* f);
+void hd44780_row(uint8_t row, char* str);
+void hd44780_print(FILE* f);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_ATOMIC_H
+#define HOST_ATOMIC_H
+
+// Host stand-in for <util/atomic.h>, nothing interrupts the host build
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for (int _atomic_once = 1; _atomic_once; _atomic_once = 0)
+
+#endif
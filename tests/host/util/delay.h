@@ -0,0 +1,11 @@
+#ifndef HOST_DELAY_H
+#define HOST_DELAY_H
+
+// Host stand-in for <util/delay.h>, delays advance the emulator clock instead of spinning
+
+#include "hd44780.h"
+
+#define _delay_us(us) hd44780_delay_us(us)
+#define _delay_ms(ms) hd44780_delay_us((ms)*1000.0)
+
+#endif
@@ -0,0 +1,190 @@
+/***
+	lcd_bench.c - Reports the LCD traffic of each display function in smart_bike.c
+	src/smart_bike.c, lcd.c, gps.c, fmt.c and clock.c are built against the HD44780 emulator in tests/host,
+	started through boot_update() on a simulated clock, fed a few NMEA fixes, and every display function
+	is timed on a layout switch and on the next fix
+
+	IMPORTANT: This is not meant to be run on the microcontroller, compile and run on a computer using gcc NOT avr-gcc
+	LCD_ASYNC needs the timer interrupt and can't be benchmarked, LCD_BUSY_FLAG can
+
+	make lcd_bench
+	./bin/lcd_bench        Boot times and a table of bytes, commands and bus time per frame
+	./bin/lcd_bench -v     Also the screen and every transaction of each frame
+**/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hd44780.h"
+
+// smart_bike.c is built into this file, so its display functions and state can be used directly
+#define main smart_bike_main
+#include "smart_bike.c"
+#undef main
+
+#if LCD_ASYNC
+#error "lcd_bench drives the LCD synchronously, build it without LCD_ASYNC"
+#endif
+
+void USART_RX_vect(void);
+void USART_UDRE_vect(void);
+void TIMER1_COMPB_vect(void);
+
+uint8_t verbose = 0;
+uint16_t second = 0;	// Seconds after 06:49:00 UTC of the next fix
+uint8_t stopped = 0;	// Set to send fixes of a parked bike
+
+// Sensors aren't emulated
+void adc_init(void) {}
+uint16_t light_reading(void) { return 1023; }
+uint16_t sonar_reading(void) { return 0xFFFF; }
+uint16_t adc_read(uint8_t index) { (void)index; return 0xFFFF; }
+uint8_t adc_sequence(void) { return 0; }
+void adc_wait(void) {}
+
+/*
+	Send a sentence through the RX interrupt, adding the checksum
+	In streaming mode a sentence doesn't fit the FIFO, so it is drained after every character
+*/
+void nmea(const char* body) {
+	char str[100];
+	uint8_t parity = 0;
+	const char* ch;
+	for (ch = body; *ch; ch++)
+		parity ^= *ch;
+	snprintf(str, sizeof(str), "$%s*%02X\r\n", body, parity);
+	for (ch = str; *ch; ch++) {
+		UDR0 = *ch;
+		USART_RX_vect();
+#if GPS_STREAM
+		gps_update();
+#endif
+	}
+}
+
+/*
+	Parse the next one second fix, moving a little north and speeding up each time
+	A parked bike only sees the GPS noise in its speed and altitude
+	Returns gps_status() for lcd_update()
+*/
+int8_t next_fix(void) {
+	char str[100];
+	uint16_t north = stopped ? 1256 : 1256 + second*7;
+	snprintf(str, sizeof(str), "GPRMC,06%02u%02u.000,A,2307.%04u,N,12016.4438,E,%u.%02u,165.48,260406,3.05,W,A",
+		49 + second/60, second%60, north, stopped ? 0 : 5 + second/4, second*13 % 100);
+	nmea(str);
+	snprintf(str, sizeof(str), "GPGGA,06%02u%02u.000,2307.%04u,N,12016.4438,E,1,8,0.95,%u.9,M,17.8,M,,",
+		49 + second/60, second%60, north, 39 + second%3);
+	nmea(str);
+	second++;
+	elapsedTime++;
+	gps_update();
+	return gps_status();
+}
+
+/*
+	Start the LCD and GPS through boot_update() the way the main loop does, one pass per ms with the
+	clock ticking every CLOCK_TICK_MS. Each GPS command is sent at once and the module doesn't answer
+*/
+void boot(void) {
+	uint16_t pass;
+	for (pass = 1; boot_state != 2 || gps_step_ms != STEP_DONE; pass++) {
+		boot_update();
+		while (UCSR0B & (1 << UDRIE0))
+			USART_UDRE_vect();
+		UCSR0A |= (1 << TXC0);
+		_delay_ms(1);
+		if (pass % CLOCK_TICK_MS == 0)
+			TIMER1_COMPB_vect();
+	}
+}
+
+void display_splash(void) {
+	lcd_layout_draw(splash_layout);
+}
+
+void display_altitude(void) {
+	line3_displayed = 0;
+	display_misc();
+}
+
+void display_speed(void) {
+	line3_displayed = 1;
+	display_misc();
+}
+
+void display_direction(void) {
+	line3_displayed = 2;
+	display_misc();
+}
+
+/*
+	Commit what display() draws and print the statistics of the frame
+*/
+void frame(void (*display)(void)) {
+	hd44780_stats_t stats;
+	hd44780_stats_reset();
+	display();
+	lcd_frame_commit();
+	hd44780_stats(&stats);
+	printf(" %6lu %5lu %9.0f %5lu", stats.bytes, stats.commands, stats.bus_us, stats.early);
+	if (verbose) {
+		printf("\n");
+		hd44780_trace(stdout);
+		hd44780_print(stdout);
+	}
+}
+
+/*
+	One row of the table: the first frame after the previous layout, then the frame of the next fix
+*/
+void bench(const char* name, void (*display)(void)) {
+	printf("%-18s", name);
+	frame(display);
+	next_fix();
+	frame(display);
+	printf("\n");
+}
+
+int main(int argc, char** argv) {
+	hd44780_stats_t stats;
+	uint8_t i;
+
+	verbose = (argc > 1 && strcmp(argv[1], "-v") == 0);
+
+	hd44780_stats_reset();
+	boot();
+	hd44780_stats(&stats);
+	printf("boot: %lu bytes, %lu early, LCD ready at %lums, GPS configured at %lums, splash done at %lums\n\n",
+		stats.bytes, stats.early, (unsigned long)lcd_ready_ms, (unsigned long)gps_ready_ms, (unsigned long)clock_ms());
+	lcd_clear();	// The table starts from a blank screen, as it did before the splash
+	wait_displaying = 0;
+
+	printf("%-18s %-29s %s\n", "", "layout switch", "next fix");
+	printf("%-18s %6s %5s %9s %5s %6s %5s %9s %5s\n", "function",
+		"bytes", "cmds", "bus us", "early", "bytes", "cmds", "bus us", "early");
+	bench("splash", display_splash);
+	bench("display_wait", display_wait);
+	bench("display_time", display_time);
+	bench("display_location", display_location);
+	bench("display_elapsed", display_elapsed);
+	bench("display_big_speed", display_big_speed);
+	bench("display_altitude", display_altitude);
+	bench("display_speed", display_speed);
+	bench("display_direction", display_direction);
+
+	// The main loop redraws once per fix, rotating the rows as the counters run out
+	printf("\n");
+	for (stopped = 0; stopped < 2; stopped++) {
+		for (i = 0; i < 30; i++)	// Long enough to be parked
+			lcd_update(next_fix());
+		hd44780_stats_reset();
+		for (i = 0; i < 60; i++)
+			lcd_update(next_fix());
+		hd44780_stats(&stats);
+		printf("lcd_update, 60 fixes %s: %.1f bytes, %.1f commands, %.0fus per fix, %lu early\n",
+			stopped ? "parked" : "moving", stats.bytes/60.0, stats.commands/60.0, stats.bus_us/60, stats.early);
+	}
+	hd44780_print(stdout);
+	return 0;
+}